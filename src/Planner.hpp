@@ -0,0 +1,165 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include "builder/AbstractBuilder.hpp"
+#include "util/memory.hpp"
+
+// Sample-based build planner. A builder indexes a sample of documents with a
+// few hash functions; per-document CW counts and build times are fitted as
+// power laws of the document length, y = a * n^b, and summed over the
+// lengths of the full corpus. Bootstrapping the sample gives a 90% band.
+
+struct PowerFit {
+    double a = 0, b = 1;
+
+    double predict(double n) const { return a * std::pow(n, b); }
+};
+
+// Least squares on log y = log a + b log n. Points must be positive.
+inline PowerFit fitPowerLaw(const std::vector<double> &n, const std::vector<double> &y,
+                            const std::vector<int> &pick) {
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (int i : pick) {
+        double lx = std::log(n[i]), ly = std::log(y[i]);
+        sx += lx;
+        sy += ly;
+        sxx += lx * lx;
+        sxy += lx * ly;
+    }
+    double m = pick.size();
+    PowerFit fit;
+    double den = m * sxx - sx * sx;
+    // All sampled documents of one length: assume linear growth.
+    fit.b = den > 1e-9 ? (m * sxy - sx * sy) / den : 1.0;
+    fit.a = std::exp((sy - fit.b * sx) / m);
+    return fit;
+}
+
+struct PlanBand {
+    double mid = 0, lo = 0, hi = 0;
+};
+
+struct PlanResult {
+    std::string name;
+    PowerFit cw_fit, time_fit;
+    PlanBand cws;       // CWs over all hash functions
+    PlanBand seconds;   // single-threaded build time
+    long long index_bytes = 0;
+};
+
+class BuildPlanner {
+private:
+    const std::vector<std::vector<int>> &sample;
+    const std::vector<int> &lengths;    // every document of the full corpus
+    int k, sample_k;
+    int boot;
+    uint64_t seed;
+
+    double extrapolate(const PowerFit &fit) const {
+        double sum = 0;
+        for (int n : lengths) {
+            if (n > 0) sum += fit.predict(n);
+        }
+        return sum * k;
+    }
+
+public:
+    BuildPlanner(const std::vector<std::vector<int>> &sample_, const std::vector<int> &lengths_,
+                 int k_, int sample_k_, int boot_ = 200, uint64_t seed_ = 1)
+        : sample(sample_), lengths(lengths_), k(k_), sample_k(std::min(k_, sample_k_)),
+          boot(boot_), seed(seed_) {}
+
+    int sampleK() const { return sample_k; }
+
+    // builder must index sample with sampleK() hash functions.
+    template<typename WeightType, typename TF>
+    PlanResult plan(const std::string &name, AbstractBuilder<WeightType, TF> &builder) const {
+        builder.buildCW();
+        const BuildStats &stats = builder.getStats();
+
+        std::vector<double> n, cw, sec;
+        for (int i = 0; i < (int)sample.size(); i++) {
+            if (sample[i].empty()) continue;
+            n.push_back(sample[i].size());
+            cw.push_back(std::max(1.0, (double)stats.docCWs(i) / sample_k));
+            sec.push_back(std::max(1e-7, stats.docSeconds(i) / sample_k));
+        }
+        if (n.empty()) {
+            throw std::runtime_error("Sample has no non-empty documents");
+        }
+
+        PlanResult r;
+        r.name = name;
+        std::vector<int> all(n.size());
+        for (int i = 0; i < (int)all.size(); i++) all[i] = i;
+        r.cw_fit = fitPowerLaw(n, cw, all);
+        r.time_fit = fitPowerLaw(n, sec, all);
+        r.cws.mid = extrapolate(r.cw_fit);
+        r.seconds.mid = extrapolate(r.time_fit);
+
+        std::vector<double> cw_boot, sec_boot;
+        std::mt19937_64 rng(seed);
+        std::uniform_int_distribution<int> pick_one(0, (int)n.size() - 1);
+        std::vector<int> pick(n.size());
+        for (int t = 0; t < boot; t++) {
+            for (auto &p : pick) p = pick_one(rng);
+            cw_boot.push_back(extrapolate(fitPowerLaw(n, cw, pick)));
+            sec_boot.push_back(extrapolate(fitPowerLaw(n, sec, pick)));
+        }
+        auto band = [](std::vector<double> &v, PlanBand &b) {
+            if (v.empty()) {
+                b.lo = b.hi = b.mid;
+                return;
+            }
+            std::sort(v.begin(), v.end());
+            b.lo = std::min(b.mid, v[(size_t)(0.05 * (v.size() - 1))]);
+            b.hi = std::max(b.mid, v[(size_t)(0.95 * (v.size() - 1))]);
+        };
+        band(cw_boot, r.cws);
+        band(sec_boot, r.seconds);
+
+        // Block table entries plus 5 ints and the weight (or its fingerprint) per CW on disk.
+        r.index_bytes = (long long)k * sizeof(IndexBlock) +
+                        (long long)(r.cws.mid * CWColumns<WeightType>::recordBytes(builder.fingerprintBits()));
+        return r;
+    }
+
+    static void print(std::ostream &os, const std::vector<PlanResult> &results) {
+        os << std::left << std::setw(38) << "config" << std::right
+           << std::setw(30) << "CWs (90% band)"
+           << std::setw(34) << "build seconds (90% band)"
+           << std::setw(14) << "index" << std::endl;
+        for (const auto &r : results) {
+            std::ostringstream cws, secs;
+            cws << std::setprecision(3) << r.cws.mid << " [" << r.cws.lo << ", " << r.cws.hi << "]";
+            secs << std::setprecision(3) << r.seconds.mid << " [" << r.seconds.lo << ", " << r.seconds.hi << "]";
+            os << std::left << std::setw(38) << r.name << std::right
+               << std::setw(30) << cws.str() << std::setw(34) << secs.str()
+               << std::setw(14) << formatBytes(r.index_bytes) << std::endl;
+            std::ostringstream fit;
+            fit << std::setprecision(3) << "    fit: cws/hash/doc = " << r.cw_fit.a << " * n^" << r.cw_fit.b
+                << ", s/hash/doc = " << r.time_fit.a << " * n^" << r.time_fit.b;
+            os << fit.str() << std::endl;
+        }
+    }
+
+    // The fastest configuration whose index is within 25% of the smallest;
+    // builders disagree on index size, and a smaller index is faster to query.
+    static int recommend(const std::vector<PlanResult> &results) {
+        double smallest = results[0].cws.mid;
+        for (const auto &r : results) smallest = std::min(smallest, r.cws.mid);
+        int best = -1;
+        for (int i = 0; i < (int)results.size(); i++) {
+            if (results[i].cws.mid > 1.25 * smallest) continue;
+            if (best < 0 || results[i].seconds.mid < results[best].seconds.mid) best = i;
+        }
+        return best;
+    }
+};
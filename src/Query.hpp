@@ -8,10 +8,25 @@
 #include <map>
 #include <set>
 #include <algorithm>
+#include <numeric>
+#include <memory>
 #include <limits>
+#include <thread>
+#include <exception>
 #include "util/cw.hpp"
+#include "util/cw_columns.hpp"
 #include "util/hasher.hpp"
+#include "util/index_utils.hpp"
+#include "util/doc_weights.hpp"
+#include "util/mapped_corpus.hpp"
+#include "util/window_jaccard.hpp"
+#include "util/match_rect.hpp"
+#include "util/result_writer.hpp"
 #include "util/tf_strategy.hpp"
+#include "util/query_stats.hpp"
+#include "util/memory.hpp"
+#include "util/simd.hpp"
+#include "util/util.hpp"
 
 const double eps = 1e-5;
 
@@ -33,16 +48,89 @@ public:
     }
 };
 
-template<typename WeightType>
+template<typename WeightType, typename TF = DynamicTF>
 class Query {
-private:
+    static_assert(TF::template supports<WeightType>,
+                  "INT WeightType is only allowed with raw TF; use DOUBLE for other TF modes");
+
+protected:
+    // A collided CW: (hash function, row in its block). Rows are 64-bit,
+    // as a block may hold more than 2^31 CWs.
+    using Hit = std::pair<int, size_t>;
+
     int k, tokenNum;
-    std::vector<std::vector<CW<WeightType>>> cws;
+    std::vector<CWColumns<WeightType>> cws;
     Hasher<WeightType> hasher;
+    TFMode tf_mode = TFMode::RAW;
+    int fp_bits = 0;
+    SimdLevel simd = detectSimdLevel();
+    std::string index_file;
+    IndexLayout layout;
+
+    // Hash functions a query probes (the first probe_k of k); with confirm,
+    // documents that reach the threshold on them are rechecked with all k.
+    int probe_k = 0;
+    bool confirm = false;
+    std::vector<char> doc_ordered;   // per hid: T nondecreasing, as builders write it
+
+    // getSignature scratch
+    std::vector<int> sig_cnt, sig_tokens;
+    std::vector<WeightType> sig_weights, sig_values;
+
+    // Corpus for rechecking fingerprint matches and verifying results, and
+    // its scratch
+    MappedCorpus *corpus = nullptr;
+    std::unique_ptr<DocWeights<WeightType>> corpus_weights;
+    std::vector<int> corpus_cnt;
+    std::vector<int> corpus_doc;   // a document in dense ids (remapped vocabulary)
+    std::unique_ptr<WindowJaccard<WeightType>> jaccard;
+    double min_similarity = 0;
+
+    // With rect_output each document's results are merged into rectangles.
+    // They are streamed to writer, or with a collector (a shard of a
+    // ShardedQuery) appended to it instead of printed or written.
+    bool rect_output = false;
+    ResultWriter *writer = nullptr;
+    std::vector<DocMatches> *collector = nullptr;
+
+    // Corpus document doc_id in the index's token ids: as stored, or copied
+    // into corpus_doc through the vocabulary map. Valid until the next call.
+    MappedCorpus::Doc corpusDoc(int doc_id) {
+        MappedCorpus::Doc doc = corpus->doc(doc_id);
+        const VocabMap &vocab = hasher.vocabMap();
+        if (vocab.empty()) return doc;
+        corpus_doc.assign(doc.tokens, doc.tokens + doc.length);
+        vocab.remap(corpus_doc.data(), doc.length, doc_id);
+        return MappedCorpus::Doc{corpus_doc.data(), doc.length};
+    }
+
+    template<typename Doc>
+    void buildCorpusWeights(const Doc &doc) {
+        corpus_weights->build(doc.tokens, doc.length, corpus_cnt, hasher, [&](int x, int max_freq) {
+            return TF::template weight<WeightType>(tf_mode, x, max_freq);
+        });
+    }
+
+    // The value cw was built with under hash function hid: the minimum over
+    // one window it covers (i in [a, b], j in [c, d], i <= j) of doc.
+    WeightType windowValue(int hid, const int *doc, const CW<WeightType> &cw) {
+        int j = std::max(cw.c, std::min(cw.b, cw.d));
+        int i = std::min(cw.b, j);
+        WeightType mn = std::numeric_limits<WeightType>::max();
+        for (int p = i; p <= j; p++) {
+            int t = doc[p];
+            mn = std::min(mn, hasher.evalWeighted(hid, t, corpus_weights->weight(t, ++corpus_cnt[t])));
+        }
+        for (int p = i; p <= j; p++) {
+            corpus_cnt[doc[p]] = 0;
+        }
+        return mn;
+    }
     
     void innerScan(std::vector<CW<WeightType>> &cws_subset, 
                    std::unordered_set<int> &ids, 
                    double threshold, 
+                   int hashes,
                    std::vector<std::pair<int, int>> &ranges) {
         std::vector<std::pair<int, int>> updates;
         for (auto id : ids) {
@@ -54,7 +142,7 @@ private:
         int cnt = 0;
         for (int i = 0; i < updates.size(); i++) {
             if (i > 0 && updates[i].first != updates[i - 1].first) {
-                if (cnt >= k * threshold - eps) {
+                if (cnt >= hashes * threshold - eps) {
                     ranges.emplace_back(updates[i - 1].first, updates[i].first - 1);
                 }
             }
@@ -62,9 +150,14 @@ private:
         }
     }
 
-    std::vector<std::pair<int, int>> outerScan(std::vector<CW<WeightType>> &cws_subset, 
-                                              double threshold) {
-        std::vector<std::pair<int, int>> results;
+    // Windows covered by at least threshold of the hashes hash functions the
+    // CWs came from (0 = the probed ones), as one rectangle per run of ends
+    // with equal coverage and inner range of starts; ordered by end, then
+    // start. mergeRects compacts them.
+    std::vector<MatchRect> scanRects(std::vector<CW<WeightType>> &cws_subset,
+                                     double threshold, int hashes = 0) {
+        if (hashes == 0) hashes = probe_k;
+        std::vector<MatchRect> rects;
         std::vector<Update> updates;
         
         for (int i = 0; i < cws_subset.size(); i++) {
@@ -75,14 +168,15 @@ private:
         std::sort(updates.begin(), updates.end());
 
         std::unordered_set<int> ids;
+        std::vector<std::pair<int, int>> ranges;
         int cnt = 0;
         for (int i = 0; i < updates.size(); i++) {
             if (i > 0 && updates[i].t != updates[i - 1].t) {
-                if (cnt >= k * threshold - eps) {
-                    std::vector<std::pair<int, int>> ranges;
-                    innerScan(cws_subset, ids, threshold, ranges);
+                if (cnt >= hashes * threshold - eps) {
+                    ranges.clear();
+                    innerScan(cws_subset, ids, threshold, hashes, ranges);
                     for (auto range : ranges) {
-                        results.emplace_back(updates[i - 1].t, range.second);
+                        rects.push_back(MatchRect{range.first, range.second, updates[i - 1].t, updates[i].t - 1});
                     }
                 }
             }
@@ -93,123 +187,537 @@ private:
                 ids.erase(updates[i].type);
             }
         }
+        return rects;
+    }
+
+    // scanRects as (first end, last start) pairs: each the shortest window
+    // [second, first] of one rectangle.
+    std::vector<std::pair<int, int>> outerScan(std::vector<CW<WeightType>> &cws_subset, 
+                                              double threshold, int hashes = 0) {
+        std::vector<std::pair<int, int>> results;
+        for (const MatchRect &r : scanRects(cws_subset, threshold, hashes)) {
+            results.emplace_back(r.end_lo, r.start_hi);
+        }
         return results;
     }
 
 public:
     Query() : k(0), tokenNum(0), hasher(0, 0) {}
     
-    void loadIndex(const std::string& filename) {
+    // Read the hasher configuration and block table; CWs stay unloaded until
+    // loadBlocks.
+    void openIndex(const std::string& filename) {
         std::ifstream file(filename, std::ios::binary);
         if (!file.is_open()) {
             throw std::runtime_error("Cannot open file for reading: " + filename);
         }
-        
-        // Load basic parameters
-        file.read(reinterpret_cast<char*>(&k), sizeof(k));
-        file.read(reinterpret_cast<char*>(&tokenNum), sizeof(tokenNum));
-        
-        // Resize CWs vector
-        cws.resize(k);
-        
-        // Load hasher configuration
-        hasher.loadFromFile(file);
-        
-        // Load CWs
-        for (int hid = 0; hid < k; hid++) {
-            size_t cw_count;
-            file.read(reinterpret_cast<char*>(&cw_count), sizeof(cw_count));
-            cws[hid].resize(cw_count);
-            for (auto& cw : cws[hid]) {
-                cw.loadFromFile(file);
+        layout = readIndexLayout(file, hasher, filename);
+        file.close();
+        index_file = filename;
+        k = hasher.getK();
+        tokenNum = hasher.getTokenNum();
+        tf_mode = hasher.getTFMode();
+        if constexpr (TF::is_static) {
+            if (tf_mode != TF::mode) {
+                throw std::runtime_error("Index TF mode does not match the query engine's compile-time TF policy");
             }
         }
-        
-        file.close();
+        fp_bits = hasher.fingerprintBits();
+        cws.assign(k, CWColumns<WeightType>());
+        doc_ordered.assign(k, 0);
+        probe_k = k;
+        confirm = false;
     }
-    
+
+    // Probe only the first hashes hash functions, requiring threshold of
+    // them. With confirm_all, documents with a range on those are then
+    // probed with the remaining ones and scanned against all k.
+    void setProbeHashes(int hashes, bool confirm_all = false) {
+        if (hashes < 1 || hashes > k) {
+            throw std::invalid_argument("Probe hash count " + std::to_string(hashes) + " outside 1.." +
+                                        std::to_string(k));
+        }
+        probe_k = hashes;
+        confirm = confirm_all && hashes < k;
+    }
+
+    int probeHashes() const { return probe_k; }
+
+    // Blocks a query reads: the probed ones, or all k when confirming.
+    int hashesNeeded() const { return confirm ? k : probe_k; }
+
+    // Load and verify the CW blocks of hash functions [first, last). With
+    // several threads each reads every threads-th block through its own
+    // stream.
+    void loadBlocks(int first, int last, int threads = 1) {
+        threads = std::max(1, std::min(threads, last - first));
+        auto load = [&](int t) {
+            std::ifstream file(index_file, std::ios::binary);
+            if (!file.is_open()) {
+                throw std::runtime_error("Cannot open file for reading: " + index_file);
+            }
+            for (int hid = first + t; hid < last; hid += threads) {
+                const IndexBlock &b = layout.blocks[hid];
+                file.seekg(b.offset);
+                Checksum sum;
+                if (fp_bits) {
+                    cws[hid].readFingerprintRecords(file, b.count, fp_bits, &sum);
+                } else {
+                    cws[hid].readRecords(file, b.count, &sum);
+                }
+                layout.verifyBlock(hid, sum, index_file);
+                doc_ordered[hid] = std::is_sorted(cws[hid].T.begin(), cws[hid].T.end());
+            }
+        };
+        if (threads == 1) {
+            load(0);
+            return;
+        }
+        std::vector<std::exception_ptr> errors(threads);
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; t++) {
+            workers.emplace_back([&, t]() {
+                try {
+                    load(t);
+                } catch (...) {
+                    errors[t] = std::current_exception();
+                }
+            });
+        }
+        for (auto &w : workers) w.join();
+        for (auto &e : errors) {
+            if (e) std::rethrow_exception(e);
+        }
+    }
+
+    // Load the blocks needed to probe the first hashes hash functions (0 =
+    // all), or all k with confirm_all.
+    void loadIndex(const std::string& filename, int threads = 1, int hashes = 0, bool confirm_all = false) {
+        openIndex(filename);
+        setProbeHashes(hashes ? hashes : k, confirm_all);
+        loadBlocks(0, hashesNeeded(), threads);
+    }
+
+    // Documents in the index; 0 for version 1 files, which do not record it.
+    uint64_t numDocs() const { return layout.num_docs; }
+    // Chunk length of an index built with -l; 0 if its documents are the corpus's.
+    uint64_t chunkLength() const { return layout.chunk_length; }
+
     std::vector<WeightType> getSignature(const std::vector<int> &query) {
-        std::vector<WeightType> signature(k);
-        
-        // Calculate max frequency for TF calculation
+        int n = (int)query.size();
+
+        // Dense token counts; sig_cnt is left zeroed on return.
+        sig_cnt.resize(tokenNum, 0);
         int max_freq = 0;
-        std::unordered_map<int, int> freqMap;
         for (auto token : query) {
-            freqMap[token]++;
-            max_freq = std::max(max_freq, freqMap[token]);
+            if (token < 0 || token >= tokenNum) {
+                throw std::out_of_range("Query token " + std::to_string(token) +
+                                        " outside the index vocabulary of size " + std::to_string(tokenNum));
+            }
+            max_freq = std::max(max_freq, ++sig_cnt[token]);
         }
-        
-        // Reset frequency map
-        freqMap.clear();
-        
-        for (int hid = 0; hid < k; hid++) {
-            if constexpr (std::is_same_v<WeightType, int>) {
-                signature[hid] = std::numeric_limits<int>::max();
-            } else {
-                signature[hid] = std::numeric_limits<double>::max();
+
+        // One entry per (token, x-th occurrence), a token's entries adjacent,
+        // with the TF weight of x computed once for all hash functions.
+        sig_tokens.clear();
+        sig_weights.clear();
+        for (auto token : query) {
+            int f = sig_cnt[token];
+            if (f == 0) continue;
+            for (int x = 1; x <= f; x++) {
+                sig_tokens.push_back(token);
+                sig_weights.push_back(TF::template weight<WeightType>(tf_mode, x, max_freq));
             }
-            
-            for (auto token : query) {
-                WeightType tf = TFCalculator<WeightType>::calculate(hasher.getTFMode(), ++freqMap[token], max_freq);
-                WeightType v = hasher.eval(hid, token, tf);
-                if (v < signature[hid]) {
-                    signature[hid] = v;
-                }
+            sig_cnt[token] = 0;
+        }
+
+        // Only the hash functions a query reads; the rest stay at the maximum.
+        std::vector<WeightType> signature(k, std::numeric_limits<WeightType>::max());
+        sig_values.resize(n);
+        for (int hid = 0; hid < hashesNeeded(); hid++) {
+            hasher.evalBatch(hid, sig_tokens.data(), sig_weights.data(), n, sig_values.data());
+            for (int i = 0; i < n; i++) {
+                signature[hid] = std::min(signature[hid], sig_values[i]);
             }
-            
-            // Reset frequency map for next hash function
-            freqMap.clear();
         }
         return signature;
     }
     
-    void query(const std::vector<int>& queryTokens, double threshold) {
-        std::vector<WeightType> signature = getSignature(queryTokens);
-        
-        std::cout << "Query signature: ";
-        for (int i = 0; i < k && i < 5; i++) {  // Show first 5 hash values
-            std::cout << signature[i] << " ";
+    // Kernel used by lookupCollisions; levels the CPU lacks fall back.
+    void setSimdLevel(SimdLevel level) { simd = level; }
+
+    int fingerprintBits() const { return fp_bits; }
+
+    // Corpus the index was built from (same documents, in order). With a
+    // fingerprinted index, matches in documents that could reach the
+    // threshold are then rechecked against the recomputed CW value;
+    // otherwise they are accepted at a false-positive rate of about
+    // 2^-fp_bits per stored CW. The documents of an index built with -l are
+    // chunks, not the corpus's, so such an index takes no corpus.
+    void setCorpus(MappedCorpus *docs) {
+        if (docs && layout.chunk_length) {
+            throw std::invalid_argument("Index documents are " + std::to_string(layout.chunk_length) +
+                                        "-token chunks (build -l), not documents of corpus " + docs->filename() +
+                                        "; fingerprint rechecks and verification need an index built without -l");
         }
-        if (k > 5) std::cout << "...";
-        std::cout << std::endl;
-        std::cout << "Finding colliding CWs..." << std::endl;
-        
-        std::map<int, std::vector<CW<WeightType>>> collided_cws;
+        if (docs && layout.num_docs && !docs->hasDoc((int)layout.num_docs - 1)) {
+            throw std::invalid_argument("Corpus " + docs->filename() + " has fewer than the index's " +
+                                        std::to_string(layout.num_docs) + " documents");
+        }
+        corpus = docs;
+        if (docs && !corpus_weights) {
+            corpus_weights = std::make_unique<DocWeights<WeightType>>(tokenNum);
+            corpus_cnt.assign(tokenNum, 0);
+        }
+    }
 
-        // Find colliding CWs
-        for (int hid = 0; hid < k; hid++) {
-            for (const auto& cw : cws[hid]) {
-                if (cw.v == signature[hid]) {
-                    collided_cws[cw.T].push_back(cw);
+    // Score each result by the exact weighted Jaccard of its window against
+    // the query (see WindowJaccard), read from the corpus, and keep those
+    // scoring at least min_sim; 0 keeps all. Needs setCorpus.
+    void setVerification(double min_sim) {
+        if (!corpus) {
+            throw std::logic_error("Verification needs the corpus (setCorpus)");
+        }
+        min_similarity = min_sim;
+        if (!jaccard) {
+            jaccard = std::make_unique<WindowJaccard<WeightType>>(tokenNum);
+        }
+    }
+
+    // Stream results to writer as merged rectangles (nullptr = print
+    // ranges). Verification then scores each rectangle's longest window,
+    // and its shortest if the longest falls short.
+    void setResultWriter(ResultWriter *w) {
+        writer = w;
+        rect_output = w != nullptr;
+    }
+
+    // Append each document's results to out (nullptr = print or write
+    // them), merged into rectangles if rects is set.
+    void setCollector(std::vector<DocMatches> *out, bool rects) {
+        collector = out;
+        rect_output = rects;
+    }
+
+    // Exact similarity of one window per rectangle in doc: the shortest,
+    // [start_hi, end_lo], or with longest set the longest, [start_lo,
+    // end_hi], and then for rectangles whose longest window falls short
+    // also the shortest, keeping the higher score. Rectangles with less
+    // than min_similarity are removed along with their scores. Windows are
+    // visited in order of start so the sliding histogram moves little
+    // between them.
+    std::vector<double> verifyResults(int doc_id, std::vector<MatchRect> &rects, bool longest) {
+        auto doc = corpusDoc(doc_id);
+        buildCorpusWeights(doc);
+        jaccard->setDoc(doc.tokens, *corpus_weights);
+        auto longest_window = [](const MatchRect &r) { return std::make_pair(r.start_lo, r.end_hi); };
+        auto shortest_window = [](const MatchRect &r) { return std::make_pair(r.start_hi, r.end_lo); };
+        std::vector<double> scores(rects.size());
+        auto scoreAll = [&](std::vector<int> order, auto window) {
+            std::sort(order.begin(), order.end(), [&](int lhs, int rhs) {
+                return window(rects[lhs]) < window(rects[rhs]);
+            });
+            for (int idx : order) {
+                auto [i, j] = window(rects[idx]);
+                if (i < 0 || j >= doc.length || i > j) {
+                    throw std::out_of_range("Result window [" + std::to_string(i) + ", " + std::to_string(j) +
+                                            "] outside corpus document " + std::to_string(doc_id));
                 }
+                scores[idx] = std::max(scores[idx], jaccard->score(i, j));
+            }
+        };
+        std::vector<int> order(rects.size());
+        std::iota(order.begin(), order.end(), 0);
+        if (longest) {
+            scoreAll(order, longest_window);
+            std::vector<int> short_of;
+            for (int idx : order) {
+                if (scores[idx] < min_similarity - eps) short_of.push_back(idx);
             }
+            scoreAll(short_of, shortest_window);
+        } else {
+            scoreAll(order, shortest_window);
         }
-        
-        int collided_cnt = 0;
-        int result_cnt = 0;
-        std::cout << "Found matches in " << collided_cws.size() << " documents:" << std::endl;
-        
+        jaccard->endDoc();
+
+        size_t kept = 0;
+        for (size_t r = 0; r < rects.size(); r++) {
+            if (scores[r] >= min_similarity - eps) {
+                rects[kept] = rects[r];
+                scores[kept] = scores[r];
+                kept++;
+            }
+        }
+        rects.resize(kept);
+        scores.resize(kept);
+        return scores;
+    }
+
+    // Append (hid, row) for the rows in [lo, hi) of hash function hid whose
+    // hash equals value. Only the v column (fp for fingerprinted indexes) is
+    // read, in chunks, by the SIMD equality kernels.
+    void probeRows(int hid, size_t lo, size_t hi, WeightType value, std::vector<Hit> &hits) const {
+        const size_t kChunk = 4096;
+        int pos[kChunk];
+        // Fingerprints fit in 32 bits; compare them as ints
+        const int *fp = reinterpret_cast<const int *>(cws[hid].fp.data());
+        int x = fp_bits ? static_cast<int>(CWColumns<WeightType>::fingerprint(value, fp_bits)) : 0;
+        for (size_t start = lo; start < hi; start += kChunk) {
+            int m = (int)std::min(kChunk, hi - start);
+            int cnt = fp_bits ? findEqual(fp + start, m, x, pos, simd)
+                              : findEqual(cws[hid].v.data() + start, m, value, pos, simd);
+            for (int j = 0; j < cnt; j++) {
+                hits.emplace_back(hid, start + pos[j]);
+            }
+        }
+    }
+
+    // (hid, row) of the CWs of the probed hash functions whose hash equals
+    // the signature value of their hash function.
+    std::vector<Hit> lookupCollisions(const std::vector<WeightType> &signature) const {
+        std::vector<Hit> hits;
+        for (int hid = 0; hid < probe_k; hid++) {
+            probeRows(hid, 0, cws[hid].size(), signature[hid], hits);
+        }
+        return hits;
+    }
+
+    // (hid, row) of the CWs of document doc under the hash functions after
+    // the probed ones that match the signature. Blocks in document order
+    // (all that builders write) are narrowed to doc's rows by binary search.
+    std::vector<Hit> confirmCollisions(int doc, const std::vector<WeightType> &signature) const {
+        std::vector<Hit> hits;
+        for (int hid = probe_k; hid < k; hid++) {
+            const std::vector<int> &T = cws[hid].T;
+            if (doc_ordered[hid]) {
+                auto range = std::equal_range(T.begin(), T.end(), doc);
+                probeRows(hid, range.first - T.begin(), range.second - T.begin(), signature[hid], hits);
+            } else {
+                size_t from = hits.size();
+                probeRows(hid, 0, T.size(), signature[hid], hits);
+                hits.erase(std::remove_if(hits.begin() + from, hits.end(),
+                                          [&](const Hit &hit) { return T[hit.second] != doc; }),
+                           hits.end());
+            }
+        }
+        return hits;
+    }
+
+    // Drop fingerprint matches whose CW value differs from the signature.
+    // Documents whose matches span fewer than need hash functions cannot
+    // produce a range and are left unchecked. Returns the surviving hits in
+    // their original order.
+    std::vector<Hit> recheckCollisions(const std::vector<Hit> &hits,
+                                                       const std::vector<WeightType> &signature,
+                                                       double need, long long &rejected) {
+        // Hits come ordered by hid, so distinct hids per document are counted
+        // by remembering the last one seen.
+        std::unordered_map<int, std::pair<int, int>> spread;  // doc -> (last hid, distinct hids)
+        for (const auto &hit : hits) {
+            auto &e = spread.try_emplace(cws[hit.first].T[hit.second], -1, 0).first->second;
+            if (e.first != hit.first) {
+                e.first = hit.first;
+                e.second++;
+            }
+        }
+
+        std::vector<size_t> order(hits.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+            return cws[hits[lhs].first].T[hits[lhs].second] < cws[hits[rhs].first].T[hits[rhs].second];
+        });
+
+        std::vector<char> keep(hits.size(), 1);
+        long long dropped = 0;
+        int current = -1;
+        MappedCorpus::Doc doc{nullptr, 0};
+        for (size_t idx : order) {
+            int hid = hits[idx].first;
+            CW<WeightType> cw = cws[hid].get(hits[idx].second);
+            if (spread[cw.T].second < need) continue;
+            if (cw.T != current) {
+                current = cw.T;
+                doc = corpusDoc(cw.T);
+                buildCorpusWeights(doc);
+            }
+            if (!(windowValue(hid, doc.tokens, cw) == signature[hid])) {
+                keep[idx] = 0;
+                dropped++;
+            }
+        }
+        rejected += dropped;
+
+        std::vector<Hit> kept;
+        kept.reserve(hits.size() - dropped);
+        for (size_t i = 0; i < hits.size(); i++) {
+            if (keep[i]) kept.push_back(hits[i]);
+        }
+        return kept;
+    }
+
+    // Group collided CWs by document id.
+    std::map<int, std::vector<CW<WeightType>>> groupCollisions(const std::vector<Hit> &hits) const {
+        std::map<int, std::vector<CW<WeightType>>> collided_cws;
+        for (const auto& hit : hits) {
+            const CWColumns<WeightType> &col = cws[hit.first];
+            collided_cws[col.T[hit.second]].push_back(col.get(hit.second));
+        }
+        return collided_cws;
+    }
+
+    // Group the CWs whose hash equals the signature by document id.
+    std::map<int, std::vector<CW<WeightType>>> findCollisions(const std::vector<WeightType> &signature) const {
+        return groupCollisions(lookupCollisions(signature));
+    }
+
+    // Query tokens (original ids) as the index numbers them: dense ids if
+    // its vocabulary is remapped. Tokens outside the vocabulary throw.
+    std::vector<int> indexTokens(const std::vector<int> &queryTokens) const {
+        const VocabMap &vocab = hasher.vocabMap();
+        if (vocab.empty()) return queryTokens;
+        std::vector<int> out(queryTokens.size());
+        for (size_t i = 0; i < out.size(); i++) out[i] = vocab.dense(queryTokens[i]);
+        return out;
+    }
+
+    // Run one query and return its per-phase timings and counts. With verbose
+    // unset only the timings are produced (batch mode).
+    QueryTimings query(const std::vector<int>& queryTokens, double threshold, bool verbose = true) {
+        QueryTimings timings;
+        auto st = timerStart();
+        std::vector<int> tokens = indexTokens(queryTokens);
+        std::vector<WeightType> signature = getSignature(tokens);
+        timings.signature = timerCheck(st);
+        search(tokens, signature, threshold, verbose, timings);
+        return timings;
+    }
+
+    // The phases of query after the signature, given one computed by an
+    // engine with the same hasher configuration and probe settings.
+    void search(const std::vector<int>& queryTokens, const std::vector<WeightType> &signature, double threshold,
+                bool verbose, QueryTimings &timings) {
+        if (jaccard) {
+            jaccard->setQuery(queryTokens, hasher, [&](int x, int max_freq) {
+                return TF::template weight<WeightType>(tf_mode, x, max_freq);
+            });
+        }
+
+        if (verbose) {
+            std::cout << "Query signature: ";
+            for (int i = 0; i < k && i < 5; i++) {  // Show first 5 hash values
+                std::cout << signature[i] << " ";
+            }
+            if (k > 5) std::cout << "...";
+            std::cout << std::endl;
+            std::cout << "Finding colliding CWs..." << std::endl;
+        }
+
+        // Find colliding CWs
+        auto st = timerStart();
+        std::vector<Hit> hits = lookupCollisions(signature);
+        timings.lookup = timerCheck(st);
+        if (fp_bits && corpus) {
+            st = timerStart();
+            hits = recheckCollisions(hits, signature, probe_k * threshold - eps, timings.rejected);
+            timings.recheck = timerCheck(st);
+        }
+        st = timerStart();
+        std::map<int, std::vector<CW<WeightType>>> collided_cws = groupCollisions(hits);
+        timings.grouping = timerCheck(st);
+        timings.collided_cws = hits.size();
+        timings.candidate_docs = collided_cws.size();
+
+        if (verbose) {
+            std::cout << "Found matches in " << collided_cws.size() << " documents:" << std::endl;
+        }
+
+        st = timerStart();
         for (auto& doc_entry : collided_cws) {
             int doc_id = doc_entry.first;
             auto& doc_cws = doc_entry.second;
             
-            auto results = outerScan(doc_cws, threshold);
-            collided_cnt += doc_cws.size();
-            result_cnt += results.size();
-            
-            if (!results.empty()) {
-                std::cout << "Document " << doc_id << ": " << results.size() << " matches" << std::endl;
-                for (size_t i = 0; i < std::min(results.size(), size_t(3)); i++) {
-                    std::cout << "  Range: [" << results[i].first << ", " << results[i].second << "]" << std::endl;
+            std::vector<MatchRect> rects = scanRects(doc_cws, threshold);
+            if (confirm && !rects.empty()) {
+                // Prefilter passed: add the other hash functions' CWs and
+                // scan again against all k.
+                auto confirm_st = timerStart();
+                std::vector<Hit> more = confirmCollisions(doc_id, signature);
+                if (fp_bits && corpus) {
+                    more = recheckCollisions(more, signature, 0, timings.rejected);
                 }
-                if (results.size() > 3) {
-                    std::cout << "  ..." << (results.size() - 3) << " more matches" << std::endl;
+                for (const auto &hit : more) {
+                    doc_cws.push_back(cws[hit.first].get(hit.second));
                 }
+                timings.collided_cws += more.size();
+                timings.confirmed_docs++;
+                rects = scanRects(doc_cws, threshold, k);
+                timings.confirm += timerCheck(confirm_st);
+            }
+            if (rects.empty()) continue;
+            if (rect_output) {
+                auto output_st = timerStart();
+                timings.result_ranges += rects.size();
+                rects = mergeRects(rects);
+                timings.output += timerCheck(output_st);
+            }
+            DocMatches matches{doc_id, std::move(rects), {}};
+            if (jaccard) {
+                auto verify_st = timerStart();
+                size_t before = matches.rects.size();
+                matches.scores = verifyResults(doc_id, matches.rects, rect_output);
+                timings.verified += before;
+                timings.unverified += before - matches.rects.size();
+                timings.verify += timerCheck(verify_st);
+            }
+            if (matches.rects.empty()) continue;
+            if (rect_output) {
+                timings.result_rects += matches.rects.size();
+            } else {
+                timings.result_ranges += matches.rects.size();
+            }
+
+            if (collector) {
+                collector->push_back(std::move(matches));
+                continue;
+            }
+            if (writer) {
+                auto output_st = timerStart();
+                writer->write(doc_id, matches.rects, matches.scores);
+                timings.output += timerCheck(output_st);
+            }
+            if (verbose) {
+                printDocMatches(std::cout, matches, rect_output);
             }
         }
-        
-        std::cout << "Total collided CWs: " << collided_cnt << std::endl;
-        std::cout << "Total result ranges: " << result_cnt << std::endl;
+        timings.scan = timerCheck(st) - timings.confirm - timings.verify - timings.output;
+
+        if (verbose) {
+            std::cout << "Total collided CWs: " << timings.collided_cws << std::endl;
+            if (fp_bits && corpus) {
+                std::cout << "Fingerprint matches rejected by recheck: " << timings.rejected << std::endl;
+            }
+            if (confirm) {
+                std::cout << "Documents confirmed with all " << k << " hash functions: " << timings.confirmed_docs
+                          << std::endl;
+            }
+            if (jaccard) {
+                std::cout << "Ranges verified: " << timings.verified << ", below similarity " << min_similarity
+                          << ": " << timings.unverified << std::endl;
+            }
+            std::cout << "Total result ranges: " << timings.result_ranges << std::endl;
+            if (rect_output) {
+                std::cout << "Rectangles written: " << timings.result_rects << std::endl;
+            }
+            std::cout << "Timing (ms): signature=" << timings.signature * 1e3
+                      << " lookup=" << timings.lookup * 1e3
+                      << " recheck=" << timings.recheck * 1e3
+                      << " grouping=" << timings.grouping * 1e3
+                      << " scan=" << timings.scan * 1e3
+                      << " confirm=" << timings.confirm * 1e3
+                      << " verify=" << timings.verify * 1e3
+                      << " output=" << timings.output * 1e3
+                      << " total=" << timings.total() * 1e3 << std::endl;
+        }
     }
     
     long long getTotalCWCount() const {
@@ -223,4 +731,24 @@ public:
     std::string getHasherInfo() const {
         return hasher.getModeInfo();
     }
+
+    const Hasher<WeightType> &getHasher() const { return hasher; }
+
+    // Items are named with prefix prepended (to tell shards apart).
+    void reportMemory(MemoryReport &report, const std::string &prefix = "") const {
+        long long used = 0, reserved = 0;
+        for (const auto& cols : cws) {
+            used += (long long)cols.size() * CWColumns<WeightType>::recordBytes(fp_bits);
+            reserved += cols.memoryBytes();
+        }
+        report.add(prefix + "cws", used, reserved);
+        report.add(prefix + "idf", hasher.idfBytes());
+        if (!hasher.vocabMap().empty()) report.add(prefix + "vocab", hasher.vocabBytes());
+        if (corpus) {
+            report.add(prefix + "corpus_offsets", corpus->offsetBytes());
+        }
+        if (jaccard) {
+            report.add(prefix + "verify", jaccard->memoryBytes() + corpus_weights->memoryBytes());
+        }
+    }
 };
\ No newline at end of file
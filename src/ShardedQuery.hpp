@@ -0,0 +1,284 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <thread>
+#include <exception>
+#include <algorithm>
+#include <stdexcept>
+#include "Query.hpp"
+
+// One line of a shard manifest.
+struct ShardSpec {
+    std::string index_file;
+    long long first_doc = -1;   // global id of the shard's document 0; -1 = follow the previous shard
+    std::string corpus_file;    // the shard's documents (.bin), for -C; optional
+};
+
+// Shard manifest: one shard per line, "<index file> [<first doc id>
+// [<corpus file>]]", blank lines and lines starting with '#' skipped. A
+// missing first doc id continues from the previous shard, which must then
+// record its document count (index format version 2 or later); the first shard
+// starts at 0.
+inline std::vector<ShardSpec> readShardManifest(const std::string &filename) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot open shard manifest: " + filename);
+    }
+    std::vector<ShardSpec> shards;
+    std::string line;
+    int line_no = 0;
+    while (std::getline(file, line)) {
+        line_no++;
+        std::istringstream iss(line);
+        ShardSpec spec;
+        if (!(iss >> spec.index_file) || spec.index_file[0] == '#') continue;
+        std::string first;
+        if (iss >> first) {
+            try {
+                spec.first_doc = std::stoll(first);
+            } catch (const std::exception &) {
+                throw std::runtime_error("Bad first document id '" + first + "' on line " +
+                                         std::to_string(line_no) + " of " + filename);
+            }
+            if (spec.first_doc < 0) {
+                throw std::runtime_error("Negative first document id on line " + std::to_string(line_no) +
+                                         " of " + filename);
+            }
+            iss >> spec.corpus_file;
+        }
+        shards.push_back(spec);
+    }
+    if (shards.empty()) {
+        throw std::runtime_error("Shard manifest lists no index files: " + filename);
+    }
+    return shards;
+}
+
+// A query over several index files holding consecutive document id ranges
+// of one corpus, built with the same hasher configuration. The signature is
+// computed once; each shard is then searched on its own thread, and the
+// results are mapped to global document ids and merged in id order. Shards
+// are loaded in parallel too, so indexes placed on different disks are read
+// concurrently.
+template<typename WeightType, typename TF = DynamicTF>
+class ShardedQuery {
+private:
+    struct Shard {
+        ShardSpec spec;
+        Query<WeightType, TF> engine;
+        std::unique_ptr<MappedCorpus> corpus;
+        std::vector<DocMatches> matches;
+        QueryTimings timings;
+    };
+    std::vector<std::unique_ptr<Shard>> shards;
+    bool rect_output = false;
+    ResultWriter *writer = nullptr;
+
+    // Run fn(shard index) for every shard, one thread each; the first error
+    // is rethrown once all have finished.
+    template<typename Fn>
+    void forEachShard(Fn fn) {
+        if (shards.size() == 1) {
+            fn(0);
+            return;
+        }
+        std::vector<std::exception_ptr> errors(shards.size());
+        std::vector<std::thread> workers;
+        for (size_t s = 0; s < shards.size(); s++) {
+            workers.emplace_back([&, s]() {
+                try {
+                    fn(s);
+                } catch (...) {
+                    errors[s] = std::current_exception();
+                }
+            });
+        }
+        for (auto &w : workers) w.join();
+        for (auto &e : errors) {
+            if (e) std::rethrow_exception(e);
+        }
+    }
+
+    // Shards may remap the vocabulary differently: CW values are keyed on
+    // original token ids, so only the rest of the configuration must match.
+    static std::string hasherBytes(const Hasher<WeightType> &hasher) {
+        std::ostringstream os;
+        hasher.saveHashConfig(os);
+        return os.str();
+    }
+
+public:
+    // Load every shard (threads per shard for its blocks, probe settings as
+    // Query::loadIndex), opening its corpus if listed, then check that the
+    // shards agree on the hasher and assign document id offsets.
+    void loadShards(const std::vector<ShardSpec> &specs, int threads = 1, int hashes = 0,
+                    bool confirm_all = false) {
+        // Headers first: a shard of another weight type or record layout
+        // would not even parse as this engine's.
+        IndexHeader first = readIndexHeader(specs[0].index_file);
+        for (const ShardSpec &spec : specs) {
+            IndexHeader h = readIndexHeader(spec.index_file);
+            if (h.k != first.k || h.tokenNum != first.tokenNum || h.use_idf != first.use_idf ||
+                h.tf_mode != first.tf_mode || h.sampler != first.sampler ||
+                h.fingerprint_bits != first.fingerprint_bits) {
+                throw std::runtime_error("Shard " + spec.index_file + " was built with a different hasher "
+                                         "configuration (k, TF, IDF, sampler or fingerprints) than " +
+                                         specs[0].index_file);
+            }
+        }
+
+        shards.clear();
+        for (const ShardSpec &spec : specs) {
+            shards.push_back(std::make_unique<Shard>());
+            shards.back()->spec = spec;
+        }
+        forEachShard([&](size_t s) {
+            Shard &shard = *shards[s];
+            shard.engine.loadIndex(shard.spec.index_file, threads, hashes, confirm_all);
+            if (!shard.spec.corpus_file.empty()) {
+                shard.corpus = std::make_unique<MappedCorpus>(shard.spec.corpus_file);
+                shard.engine.setCorpus(shard.corpus.get());
+            }
+        });
+
+        std::string config = hasherBytes(shards[0]->engine.getHasher());
+        for (size_t s = 0; s < shards.size(); s++) {
+            Shard &shard = *shards[s];
+            if (s > 0 && hasherBytes(shard.engine.getHasher()) != config) {
+                throw std::runtime_error("Shard " + shard.spec.index_file + " was built with a different hasher "
+                                         "configuration (k, seed, TF, IDF, sampler or fingerprints) than " + shards[0]->spec.index_file);
+            }
+            if (shard.spec.first_doc >= 0) continue;
+            if (s == 0) {
+                shard.spec.first_doc = 0;
+                continue;
+            }
+            const Shard &prev = *shards[s - 1];
+            if (prev.engine.numDocs() == 0) {
+                throw std::runtime_error("Shard " + shard.spec.index_file + " needs an explicit first document id: " +
+                                         prev.spec.index_file + " does not record its document count");
+            }
+            shard.spec.first_doc = prev.spec.first_doc + (long long)prev.engine.numDocs();
+        }
+        for (size_t s = 1; s < shards.size(); s++) {
+            const Shard &prev = *shards[s - 1];
+            if (shards[s]->spec.first_doc < prev.spec.first_doc + (long long)prev.engine.numDocs()) {
+                throw std::runtime_error("Shard " + shards[s]->spec.index_file + " overlaps the document ids of " +
+                                         prev.spec.index_file);
+            }
+        }
+        for (auto &shard : shards) {
+            shard->engine.setCollector(&shard->matches, rect_output);
+        }
+    }
+
+    size_t numShards() const { return shards.size(); }
+    const ShardSpec &shard(size_t s) const { return shards[s]->spec; }
+    const Query<WeightType, TF> &engine(size_t s) const { return shards[s]->engine; }
+
+    // Verification as Query::setVerification; every shard needs its corpus.
+    void setVerification(double min_sim) {
+        for (auto &shard : shards) {
+            if (!shard->corpus) {
+                throw std::invalid_argument("Verification needs a corpus for every shard; none listed for " +
+                                            shard->spec.index_file);
+            }
+            shard->engine.setVerification(min_sim);
+        }
+    }
+
+    // Stream merged rectangles to w, as Query::setResultWriter.
+    void setResultWriter(ResultWriter *w) {
+        writer = w;
+        rect_output = w != nullptr;
+        for (auto &shard : shards) {
+            shard->engine.setCollector(&shard->matches, rect_output);
+        }
+    }
+
+    // Run one query on all shards. Counts are summed over the shards; phase
+    // times are the slowest shard's, plus the merge in output.
+    QueryTimings query(const std::vector<int> &queryTokens, double threshold, bool verbose = true) {
+        QueryTimings timings;
+        auto st = timerStart();
+        std::vector<WeightType> signature = shards[0]->engine.getSignature(shards[0]->engine.indexTokens(queryTokens));
+        timings.signature = timerCheck(st);
+
+        // The signature holds for every shard; the tokens, for verification,
+        // are in each shard's own ids.
+        forEachShard([&](size_t s) {
+            Shard &shard = *shards[s];
+            shard.matches.clear();
+            shard.timings = QueryTimings();
+            shard.engine.search(shard.engine.indexTokens(queryTokens), signature, threshold, false, shard.timings);
+        });
+
+        st = timerStart();
+        std::vector<DocMatches> merged;
+        for (auto &shard : shards) {
+            const QueryTimings &t = shard->timings;
+            timings.lookup = std::max(timings.lookup, t.lookup);
+            timings.recheck = std::max(timings.recheck, t.recheck);
+            timings.grouping = std::max(timings.grouping, t.grouping);
+            timings.scan = std::max(timings.scan, t.scan);
+            timings.confirm = std::max(timings.confirm, t.confirm);
+            timings.verify = std::max(timings.verify, t.verify);
+            timings.output = std::max(timings.output, t.output);
+            timings.collided_cws += t.collided_cws;
+            timings.candidate_docs += t.candidate_docs;
+            timings.result_ranges += t.result_ranges;
+            timings.result_rects += t.result_rects;
+            timings.rejected += t.rejected;
+            timings.confirmed_docs += t.confirmed_docs;
+            timings.verified += t.verified;
+            timings.unverified += t.unverified;
+            for (DocMatches &m : shard->matches) {
+                m.doc += (int)shard->spec.first_doc;
+                merged.push_back(std::move(m));
+            }
+        }
+        std::stable_sort(merged.begin(), merged.end(), [](const DocMatches &lhs, const DocMatches &rhs) {
+            return lhs.doc < rhs.doc;
+        });
+        for (const DocMatches &m : merged) {
+            if (writer) writer->write(m.doc, m.rects, m.scores);
+            if (verbose) printDocMatches(std::cout, m, rect_output);
+        }
+        timings.output += timerCheck(st);
+
+        if (verbose) {
+            std::cout << "Shards: " << shards.size() << ", candidate documents: " << timings.candidate_docs
+                      << ", collided CWs: " << timings.collided_cws << std::endl;
+            std::cout << "Total result ranges: " << timings.result_ranges << std::endl;
+            if (rect_output) {
+                std::cout << "Rectangles written: " << timings.result_rects << std::endl;
+            }
+            std::cout << "Timing (ms, slowest shard per phase): signature=" << timings.signature * 1e3
+                      << " lookup=" << timings.lookup * 1e3
+                      << " recheck=" << timings.recheck * 1e3
+                      << " grouping=" << timings.grouping * 1e3
+                      << " scan=" << timings.scan * 1e3
+                      << " confirm=" << timings.confirm * 1e3
+                      << " verify=" << timings.verify * 1e3
+                      << " output=" << timings.output * 1e3
+                      << " total=" << timings.total() * 1e3 << std::endl;
+        }
+        return timings;
+    }
+
+    long long getTotalCWCount() const {
+        long long total = 0;
+        for (const auto &shard : shards) total += shard->engine.getTotalCWCount();
+        return total;
+    }
+
+    void reportMemory(MemoryReport &report) const {
+        for (size_t s = 0; s < shards.size(); s++) {
+            shards[s]->engine.reportMemory(report, "shard" + std::to_string(s) + ".");
+        }
+    }
+};
@@ -0,0 +1,423 @@
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <random>
+#include <set>
+#include <functional>
+#include <map>
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+#include "./util/util.hpp"
+#include "./util/json.hpp"
+#include "./util/splay.hpp"
+#include "./util/synth.hpp"
+#include "./util/simd.hpp"
+#include "./builder/AllAlignBuilder.hpp"
+#include "./builder/MonotonicBuilder.hpp"
+#include "./builder/SingleColumnBuilder.hpp"
+#include "./Query.hpp"
+
+using namespace std;
+
+// Exposes the protected steps of MonotonicBuilder to the micro benchmarks.
+template<typename WeightType>
+struct MonotonicProbe : public MonotonicBuilder<WeightType> {
+    using MonotonicBuilder<WeightType>::MonotonicBuilder;
+    using MonotonicBuilder<WeightType>::prepareDoc;
+    using MonotonicBuilder<WeightType>::generateKeys;
+    using MonotonicBuilder<WeightType>::generateActiveKeys;
+    using MonotonicBuilder<WeightType>::searchInSetLinear;
+};
+
+template<typename WeightType>
+struct QueryProbe : public Query<WeightType> {
+    using Query<WeightType>::outerScan;
+};
+
+struct BenchResult {
+    string name;
+    long long items;
+    int reps;
+    double median_s, min_s;
+
+    double nsPerItem() const { return items > 0 ? median_s / items * 1e9 : 0.0; }
+};
+
+struct BenchConfig {
+    int reps = 5;
+    double scale = 1.0;
+    int tokenNum = 50257;
+    string filter;
+    string tmp_dir = "/tmp";
+};
+
+static volatile long long sink;
+
+// Run body once to warm up, then reps times; record median and best.
+// Benchmarks not matching the -b filter are skipped.
+void runBench(const BenchConfig &cfg, vector<BenchResult> &out, const string &name, long long items,
+              const function<void()> &body) {
+    if (!cfg.filter.empty() && name.find(cfg.filter) == string::npos) {
+        return;
+    }
+    body();
+    vector<double> times;
+    for (int r = 0; r < cfg.reps; r++) {
+        auto st = timerStart();
+        body();
+        times.push_back(timerCheck(st));
+    }
+    sort(times.begin(), times.end());
+    BenchResult res{name, items, cfg.reps, times[times.size() / 2], times.front()};
+    printf("%-40s %12.1f ns/item  (median %.4f s, best %.4f s, %lld items)\n",
+           name.c_str(), res.nsPerItem(), res.median_s, res.min_s, items);
+    fflush(stdout);
+    out.push_back(res);
+}
+
+// Zipf-distributed token streams, so repeated tokens (and therefore TF
+// weights > 1) show up as in natural text.
+vector<vector<int>> makeDocs(int count, int length, int vocab, unsigned seed) {
+    SynthConfig synth;
+    synth.vocab = vocab;
+    synth.mean_length = length;
+    synth.length_dist = LengthDist::FIXED;
+    synth.seed = seed;
+    SyntheticCorpus corpus(synth);
+    vector<vector<int>> docs(count);
+    for (int i = 0; i < count; i++) {
+        corpus.generate(i, docs[i]);
+    }
+    return docs;
+}
+
+int scaled(const BenchConfig &cfg, int n) {
+    return max(1, (int)(n * cfg.scale));
+}
+
+void benchHasher(const BenchConfig &cfg, vector<BenchResult> &out) {
+    int n = scaled(cfg, 20000);
+    mt19937 rng(1);
+    vector<int> tokens(n), freqs(n);
+    for (int i = 0; i < n; i++) {
+        tokens[i] = rng() % cfg.tokenNum;
+        freqs[i] = 1 + rng() % 8;
+    }
+    Hasher<int> hi(4, cfg.tokenNum);
+    runBench(cfg, out, "hasher/eval_int", n, [&]() {
+        long long s = 0;
+        for (int i = 0; i < n; i++) s += hi.eval(i & 3, tokens[i], freqs[i]);
+        sink = s;
+    });
+    Hasher<double> hd(4, cfg.tokenNum);
+    runBench(cfg, out, "hasher/eval_double", n, [&]() {
+        double s = 0;
+        for (int i = 0; i < n; i++) s += hd.eval(i & 3, tokens[i], 1.0 + std::log(freqs[i]));
+        sink = (long long)s;
+    });
+    hd.setSampler(CWSSampler::ICWS);
+    runBench(cfg, out, "hasher/eval_double_icws", n, [&]() {
+        double s = 0;
+        for (int i = 0; i < n; i++) s += hd.eval(i & 3, tokens[i], 1.0 + std::log(freqs[i]));
+        sink = (long long)s;
+    });
+}
+
+void benchMonotonicKeys(const BenchConfig &cfg, vector<BenchResult> &out) {
+    int len = scaled(cfg, 2048);
+    auto docs = makeDocs(1, len, 4096, 2);
+    MonotonicProbe<int> probe(docs, 1, cfg.tokenNum, true, SearchStrategy::BINARY_SEARCH);
+    vector<pair<int, int>> keys;
+    keys.reserve(len);
+    probe.prepareDoc(docs[0]);
+    runBench(cfg, out, "monotonic/generate_keys", len, [&]() {
+        keys.clear();
+        probe.generateKeys(0, docs[0], keys);
+        sink = keys.size();
+    });
+    runBench(cfg, out, "monotonic/generate_active_keys", len, [&]() {
+        keys.clear();
+        probe.generateActiveKeys(0, docs[0], keys);
+        sink = keys.size();
+    });
+}
+
+// Both structures hold the same staircase of (x, y) pairs the builder keeps:
+// x and y increase together.
+void benchSearch(const BenchConfig &cfg, vector<BenchResult> &out) {
+    int m = scaled(cfg, 1024);
+    int q = scaled(cfg, 100000);
+    mt19937 rng(3);
+    vector<pair<int, int>> pairs;
+    int x = 0, y = 0;
+    for (int i = 0; i < m; i++) {
+        x += 1 + rng() % 4;
+        y = max(y + 1, x + (int)(rng() % 8));
+        pairs.emplace_back(x, y);
+    }
+    int limit = y + 8;
+    vector<pair<int, int>> probes(q);
+    for (auto &p : probes) {
+        p.first = rng() % limit;
+        p.second = p.first + rng() % 16;
+    }
+
+    SplayTree tree;
+    set<pair<int, int>> S;
+    tree.insert(-1, -1);
+    tree.insert(limit, limit);
+    S.insert({-1, -1});
+    S.insert({limit, limit});
+    for (auto &p : pairs) {
+        tree.insert(p.first, p.second);
+        S.insert(p);
+    }
+    vector<vector<int>> none;
+    MonotonicProbe<int> probe(none, 1, 1, true, SearchStrategy::LINEAR_SCAN);
+
+    runBench(cfg, out, "search/splay", q, [&]() {
+        long long s = 0;
+        for (auto &p : probes) s += tree.searchByX(p.first) + tree.searchByY(p.second);
+        sink = s;
+    });
+    runBench(cfg, out, "search/set_linear", q, [&]() {
+        long long s = 0;
+        for (auto &p : probes) {
+            auto ret = probe.searchInSetLinear(S, p);
+            s += ret.first->first + ret.second->first;
+        }
+        sink = s;
+    });
+}
+
+struct BuilderCase {
+    string name;
+    int max_len;   // skip buckets longer than this (quadratic baselines)
+    function<unique_ptr<AbstractBuilder<int>>(const vector<vector<int>> &, int, int)> make;
+};
+
+void benchBuilds(const BenchConfig &cfg, vector<BenchResult> &out) {
+    vector<BuilderCase> cases = {
+        {"monotonic", 1 << 30, [](auto &d, int k, int v) { return make_unique<MonotonicBuilder<int>>(d, k, v, true, SearchStrategy::BINARY_SEARCH); }},
+        {"monotonic_linear", 1 << 30, [](auto &d, int k, int v) { return make_unique<MonotonicBuilder<int>>(d, k, v, true, SearchStrategy::LINEAR_SCAN); }},
+        {"allalign", 1 << 30, [](auto &d, int k, int v) { return make_unique<AllAlignBuilder<int>>(d, k, v); }},
+        {"allalign_x", 1 << 30, [](auto &d, int k, int v) { return make_unique<AllAlignBuilder<int>>(d, k, v, 1, true); }},
+        {"single", 128, [](auto &d, int k, int v) { return make_unique<SingleColumnBuilder<int>>(d, k, v); }},
+        {"single_x", 1 << 30, [](auto &d, int k, int v) { return make_unique<SingleColumnBuilder<int>>(d, k, v, true); }},
+    };
+    int total = scaled(cfg, 4096);
+    for (int len : {128, 512, 2048}) {
+        int count = max(1, total / len);
+        auto docs = makeDocs(count, len, 4096, 4 + len);
+        for (auto &bc : cases) {
+            if (len > bc.max_len) continue;
+            runBench(cfg, out, "build/" + bc.name + "/len" + to_string(len), (long long)count * len, [&]() {
+                auto builder = bc.make(docs, 1, cfg.tokenNum);
+                builder->buildCW();
+                sink = builder->getSize();
+            });
+        }
+    }
+}
+
+// Equality scan over one hash column with each kernel the CPU supports.
+template<typename T>
+void benchScanKernels(const BenchConfig &cfg, vector<BenchResult> &out, const string &type) {
+    int n = scaled(cfg, 1 << 20);
+    mt19937 rng(11);
+    vector<T> column(n);
+    for (auto &x : column) x = (T)(rng() % 100000);
+    vector<int> pos(n);
+    for (SimdLevel level : {SimdLevel::SCALAR, SimdLevel::AVX2, SimdLevel::AVX512}) {
+        if (level > detectSimdLevel()) break;
+        runBench(cfg, out, "scan/equal_" + type + "_" + simdLevelName(level), n, [&]() {
+            sink = findEqual(column.data(), n, column[n / 2], pos.data(), level);
+        });
+    }
+}
+
+void benchIndexAndQuery(const BenchConfig &cfg, vector<BenchResult> &out) {
+    int k = 16;
+    int len = scaled(cfg, 512);
+    auto docs = makeDocs(8, len, 4096, 5);
+    MonotonicBuilder<int> builder(docs, k, cfg.tokenNum, true, SearchStrategy::BINARY_SEARCH);
+    builder.buildCW();
+    string path = cfg.tmp_dir + "/bench_index_" + to_string(getpid()) + ".data";
+    long long cw_count = builder.getSize();
+    builder.saveIndex(path);
+
+    runBench(cfg, out, "index/save", cw_count, [&]() { builder.saveIndex(path); });
+    QueryProbe<int> engine;
+    runBench(cfg, out, "index/load", cw_count, [&]() {
+        QueryProbe<int> fresh;
+        fresh.loadIndex(path);
+        sink = fresh.getTotalCWCount();
+    });
+    engine.loadIndex(path);
+    std::remove(path.c_str());
+
+    // Query with a passage of document 3 so that collisions exist.
+    vector<int> query(docs[3].begin() + len / 4, docs[3].begin() + len / 2);
+    vector<int> signature;
+    runBench(cfg, out, "query/signature", (long long)query.size() * k, [&]() {
+        signature = engine.getSignature(query);
+    });
+    map<int, vector<CW<int>>> collided;
+    runBench(cfg, out, "query/collisions", engine.getTotalCWCount(), [&]() {
+        collided = engine.findCollisions(signature);
+        sink = collided.size();
+    });
+    long long collided_cnt = 0;
+    for (auto &entry : collided) collided_cnt += entry.second.size();
+    runBench(cfg, out, "query/outer_scan", max(1LL, collided_cnt), [&]() {
+        long long s = 0;
+        for (auto &entry : collided) s += engine.outerScan(entry.second, 0.5).size();
+        sink = s;
+    });
+}
+
+void writeResults(const string &file, const BenchConfig &cfg, const vector<BenchResult> &results) {
+    ofstream ofs(file);
+    if (!ofs.is_open()) {
+        throw runtime_error("Cannot open file for writing: " + file);
+    }
+    JsonWriter json(ofs);
+    json.beginObject();
+    json.key("config").beginObject()
+        .field("reps", cfg.reps)
+        .field("scale", cfg.scale)
+        .field("tokenNum", cfg.tokenNum)
+        .endObject();
+    json.key("benchmarks").beginArray();
+    for (auto &r : results) {
+        json.beginObject()
+            .field("name", r.name)
+            .field("items", r.items)
+            .field("reps", r.reps)
+            .field("median_s", r.median_s)
+            .field("min_s", r.min_s)
+            .field("ns_per_item", r.nsPerItem())
+            .endObject();
+    }
+    json.endArray();
+    json.endObject();
+    ofs << "\n";
+}
+
+// Reads the name -> ns_per_item pairs back from a file written by writeResults.
+map<string, double> readBaseline(const string &file) {
+    ifstream ifs(file);
+    if (!ifs.is_open()) {
+        throw runtime_error("Cannot open baseline file: " + file);
+    }
+    stringstream ss;
+    ss << ifs.rdbuf();
+    string text = ss.str();
+    map<string, double> ret;
+    const string name_key = "\"name\":\"", ns_key = "\"ns_per_item\":";
+    for (size_t at = text.find(name_key); at != string::npos; at = text.find(name_key, at)) {
+        at += name_key.size();
+        size_t end = text.find('"', at);
+        string name = text.substr(at, end - at);
+        size_t next = text.find(name_key, end);
+        size_t ns = text.find(ns_key, end);
+        if (ns != string::npos && ns < next) {
+            ret[name] = atof(text.c_str() + ns + ns_key.size());
+        }
+        at = end;
+    }
+    return ret;
+}
+
+// Returns the number of benchmarks slower than baseline by more than tolerance.
+int compareResults(const map<string, double> &baseline, const vector<BenchResult> &results, double tolerance) {
+    int regressions = 0;
+    printf("\n%-40s %14s %14s %8s\n", "benchmark", "baseline ns", "current ns", "ratio");
+    for (auto &r : results) {
+        auto it = baseline.find(r.name);
+        if (it == baseline.end() || it->second <= 0) {
+            printf("%-40s %14s %14.1f %8s\n", r.name.c_str(), "-", r.nsPerItem(), "new");
+            continue;
+        }
+        double ratio = r.nsPerItem() / it->second;
+        bool regressed = ratio > 1.0 + tolerance;
+        regressions += regressed;
+        printf("%-40s %14.1f %14.1f %7.2fx%s\n", r.name.c_str(), it->second, r.nsPerItem(), ratio,
+               regressed ? "  REGRESSION" : "");
+    }
+    printf("%d regression(s) beyond %.0f%%\n", regressions, tolerance * 100);
+    return regressions;
+}
+
+int main(int argc, char *argv[]) {
+    BenchConfig cfg;
+    string out_file = "bench_results.json";
+    string baseline_file;
+    double tolerance = 0.10;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "o:c:r:R:s:b:d:v:")) != EOF) {
+        switch (opt) {
+        case 'o':
+            out_file = optarg;
+            break;
+        case 'c':
+            baseline_file = optarg;
+            break;
+        case 'r':
+            tolerance = stod(optarg);
+            break;
+        case 'R':
+            cfg.reps = max(1, stoi(optarg));
+            break;
+        case 's':
+            cfg.scale = stod(optarg);
+            break;
+        case 'b':
+            cfg.filter = optarg;
+            break;
+        case 'd':
+            cfg.tmp_dir = optarg;
+            break;
+        case 'v':
+            cfg.tokenNum = stoi(optarg);
+            break;
+        case '?':
+            std::cout << "Benchmark Suite - OptAlign" << std::endl;
+            std::cout << "Usage: bench [-o results.json] [-c baseline.json] [options]" << std::endl;
+            std::cout << std::endl;
+            std::cout << "Optional:" << std::endl;
+            std::cout << "  -o <file>     JSON results file (default: bench_results.json)" << std::endl;
+            std::cout << "  -c <file>     Compare against a saved results file; exit 2 on regressions" << std::endl;
+            std::cout << "  -r <frac>     Regression tolerance for -c (default: 0.10)" << std::endl;
+            std::cout << "  -R <num>      Timed repetitions per benchmark (default: 5)" << std::endl;
+            std::cout << "  -s <factor>   Scale input sizes (default: 1.0)" << std::endl;
+            std::cout << "  -b <text>     Only run benchmarks whose name contains text" << std::endl;
+            std::cout << "  -d <dir>      Directory for temporary index files (default: /tmp)" << std::endl;
+            std::cout << "  -v <num>      Vocabulary size (default: 50257 for GPT-2)" << std::endl;
+            return 0;
+        }
+    }
+
+    vector<BenchResult> results;
+    benchHasher(cfg, results);
+    benchMonotonicKeys(cfg, results);
+    benchSearch(cfg, results);
+    benchBuilds(cfg, results);
+    benchIndexAndQuery(cfg, results);
+    benchScanKernels<int>(cfg, results, "int");
+    benchScanKernels<double>(cfg, results, "double");
+
+    writeResults(out_file, cfg, results);
+    cout << "Results written to: " << out_file << endl;
+
+    if (!baseline_file.empty()) {
+        int regressions = compareResults(readBaseline(baseline_file), results, tolerance);
+        return regressions > 0 ? 2 : 0;
+    }
+    return 0;
+}
@@ -1,75 +1,159 @@
 #include <string>
+#include <memory>
 #include <vector>
 #include <iostream>
 #include <fstream>
 #include <random>
+#include <algorithm>
 #include <chrono>
 #include <assert.h>
 #include <stdexcept>
 #include <unistd.h>
+#include <getopt.h>
 #include "./util/IO.hpp"
 #include "./util/util.hpp"
 #include "./util/tf_strategy.hpp"
+#include "./util/cws_sampler.hpp"
+#include "./util/memory.hpp"
+#include "./util/estimate.hpp"
+#include "./util/mapped_corpus.hpp"
+#include "./util/vocab_map.hpp"
 #include "./builder/AllAlignBuilder.hpp"
 #include "./builder/MonotonicBuilder.hpp"
 #include "./builder/SingleColumnBuilder.hpp"
+#include "./builder/BuildPipeline.hpp"
+#include "./Planner.hpp"
 
 using namespace std;
 
-template<typename WeightType>
-void buildAndSaveIndex(const std::vector<std::vector<int>>& docs, int k, int tokenNum,
-                       const std::string& tf_strategy, const std::string& idf_file,
-                       const std::string& index_file, const std::string& builder_name,
-                       bool mono_active = true, SearchStrategy mono_strategy = SearchStrategy::BINARY_SEARCH,
-                       bool run_validation = false) {
-
-    std::unique_ptr<AbstractBuilder<WeightType>> builder;
+// Create the builder selected on the command line, with TF mode and IDF set.
+template<typename WeightType, typename TF>
+std::unique_ptr<AbstractBuilder<WeightType, TF>> makeBuilder(const std::vector<std::vector<int>>& docs, int k, int tokenNum,
+                                                         const std::string& tf_strategy, const std::string& idf_file,
+                                                         CWSSampler sampler, int fp_bits, const std::string& builder_name, bool mono_active,
+                                                         SearchStrategy mono_strategy, int threads, bool accelerated) {
+    std::unique_ptr<AbstractBuilder<WeightType, TF>> builder;
     if (builder_name == "allalign") {
-        builder = std::make_unique<AllAlignBuilder<WeightType>>(docs, k, tokenNum);
+        builder = std::make_unique<AllAlignBuilder<WeightType, TF>>(docs, k, tokenNum, threads, accelerated);
     } else if (builder_name == "monotonic") {
-        builder = std::make_unique<MonotonicBuilder<WeightType>>(docs, k, tokenNum, mono_active, mono_strategy);
+        builder = std::make_unique<MonotonicBuilder<WeightType, TF>>(docs, k, tokenNum, mono_active, mono_strategy);
     } else if (builder_name == "single" || builder_name == "singlecolumn") {
-        builder = std::make_unique<SingleColumnBuilder<WeightType>>(docs, k, tokenNum);
+        builder = std::make_unique<SingleColumnBuilder<WeightType, TF>>(docs, k, tokenNum, accelerated);
     } else {
         throw std::invalid_argument("Unknown builder '" + builder_name + "'. Valid: allalign, monotonic, single");
     }
     
     // Configure TF strategy (validate upstream in main, enforce here defensively)
-    TFMode tf_mode = TFMode::RAW;
-    if (tf_strategy == "raw") {
-        tf_mode = TFMode::RAW;
-    } else if (tf_strategy == "log") {
-        tf_mode = TFMode::LOG_NORMALIZED;
-    } else if (tf_strategy == "boolean") {
-        tf_mode = TFMode::BOOLEAN;
-    } else if (tf_strategy == "augmented") {
-        tf_mode = TFMode::AUGMENTED;
-    } else if (tf_strategy == "square") {
-        tf_mode = TFMode::SQUARE;
-    } else {
-        throw std::invalid_argument(
-            "Unknown TF strategy '" + tf_strategy + "'. Valid: raw, log, boolean, augmented, square.");
-    }
-    
-    builder->setTFMode(tf_mode);
+    builder->setTFMode(parseTFMode(tf_strategy));
     
+    builder->setSampler(sampler);
+    builder->setFingerprintBits(fp_bits);
+
     // Configure IDF
     if (!idf_file.empty()) {
         builder->loadIDF(idf_file);
     }
+    return builder;
+}
+
+// Occurrences of each token in the first doc_num documents (0 = all) of a
+// corpus file, read through a mapping, for a vocabulary map built ahead of
+// a pipelined build.
+std::vector<long long> countCorpusOccurrences(const std::string& src_file, int doc_num, int tokenNum) {
+    MappedCorpus corpus(src_file);
+    int n = corpus.locateAll(doc_num);
+    std::vector<long long> count(tokenNum, 0);
+    for (int i = 0; i < n; i++) {
+        MappedCorpus::Doc d = corpus.doc(i);
+        checkTokens(d.tokens, d.length, tokenNum, i);
+        for (int j = 0; j < d.length; j++) count[d.tokens[j]]++;
+    }
+    return count;
+}
+
+// Write the offsets sidecar of the first doc_num documents (0 = all) of the
+// corpus an index was built from, so query -C need not locate them by
+// walking the length prefixes. A corpus directory that cannot be written is
+// only reported.
+void writeCorpusOffsets(const std::string& src_file, int doc_num) {
+    try {
+        auto offsets_st = timerStart();
+        MappedCorpus corpus(src_file);
+        int n = corpus.locateAll(doc_num);
+        corpus.writeOffsets();
+        cout << "Corpus offsets of " << n << " documents written to: " << corpus.offsetsPath() << " ("
+             << timerCheck(offsets_st) << " s)" << endl;
+    } catch (const std::exception& e) {
+        cout << "Warning: corpus offsets not written: " << e.what() << endl;
+    }
+}
+
+void printVocabMap(std::ostream& os, const VocabMap& vocab, double seconds) {
+    os << "Vocabulary: " << vocab.usedTokens() << " of " << vocab.size() << " tokens used, remapped by frequency in "
+       << seconds << " s" << endl;
+}
+
+// How much of the index went through the spill file, if a budget was set.
+template<typename WeightType>
+void printSpill(std::ostream& os, const CWSpill<WeightType>* spill, const std::string& spill_dir) {
+    if (!spill) return;
+    os << "Spilled: " << spill->spilledCWs() << " CWs in " << spill->runCount() << " runs ("
+       << formatBytes(spill->spilledBytes()) << ") to " << spill_dir << ", lists capped at " << spill->runCWs()
+       << " CWs per hash function" << endl;
+}
+
+template<typename WeightType, typename TF>
+void buildAndSaveIndex(const std::vector<std::vector<int>>& docs, int k, int tokenNum,
+                       const std::string& tf_strategy, const std::string& idf_file, CWSSampler sampler,
+                       int fp_bits, const std::string& index_file, const std::string& builder_name,
+                       bool mono_active = true, SearchStrategy mono_strategy = SearchStrategy::BINARY_SEARCH,
+                       bool run_validation = false, int threads = 1, bool accelerated = false,
+                       const std::string& report_file = "", int top_n = 10, double load_seconds = 0,
+                       long long mem_budget = 0, const std::string& spill_dir = "",
+                       const VocabMap* vocab = nullptr, double remap_seconds = 0, int chunk_length = 0) {
+
+    std::unique_ptr<AbstractBuilder<WeightType, TF>> builder =
+        makeBuilder<WeightType, TF>(docs, k, tokenNum, tf_strategy, idf_file, sampler, fp_bits, builder_name,
+                                mono_active, mono_strategy, threads, accelerated);
+    builder->setChunkLength(chunk_length);
+    if (vocab) {
+        builder->setVocabMap(*vocab);
+    }
+    if (mem_budget > 0) {
+        builder->setMemoryBudget(mem_budget, spill_dir);
+    }
     
+    BuildStats& stats = builder->getStats();
+
     // Run alignment
     auto gen_st = timerStart();
     builder->buildCW();
-    cout << "Index Generation Time: " << timerCheck(gen_st) << " s" << endl;
+    double gen_seconds = timerCheck(gen_st);
+    stats.addPhase("load", load_seconds);
+    if (vocab) {
+        stats.addPhase("remap", remap_seconds);
+    }
+    stats.addPhase("build", gen_seconds);
+    cout << "Index Generation Time: " << gen_seconds << " s" << endl;
     cout << "Index Size: " << builder->getSize() << endl;
+    BuildCounters total = stats.total();
+    cout << "Counters: keys=" << total.keys << " skipped=" << total.keys_skipped
+         << " searches=" << total.searches << " removals=" << total.removals
+         << " ranges=" << total.ranges << " cws=" << total.cws << endl;
 
     if (run_validation) {
         cout << "Running validation..." << endl;
+        auto val_st = timerStart();
         builder->validation();
+        stats.addPhase("validation", timerCheck(val_st));
         cout << "Validation done." << endl;
     }
 
+    MemoryReport memory;
+    builder->reportMemory(memory);
+    memory.print(cout);
+    printSpill(cout, builder->getSpill(), spill_dir);
+
     // builder->display();
     
     if constexpr (std::is_same_v<WeightType, int>) {
@@ -81,9 +165,161 @@ void buildAndSaveIndex(const std::vector<std::vector<int>>& docs, int k, int tok
     // Save index
     if (!index_file.empty()) {
         cout << "Saving index to: " << index_file << endl;
+        auto save_st = timerStart();
         builder->saveIndex(index_file);
+        stats.addPhase("save", timerCheck(save_st));
+        cout << "Index saved successfully" << endl;
+    }
+
+    if (!report_file.empty()) {
+        std::ofstream report(report_file);
+        if (!report.is_open()) {
+            throw std::runtime_error("Cannot open file for writing: " + report_file);
+        }
+        stats.writeJson(report, docs, top_n, &memory);
+        cout << "Build report written to: " << report_file << endl;
+    }
+}
+
+// Stream the corpus through a BuildPipeline instead of loading it whole, then
+// write the index. Produces the same index as buildAndSaveIndex.
+template<typename WeightType, typename TF>
+void buildPipelined(const std::string& src_file, int k, int tokenNum, const std::string& tf_strategy,
+                    const std::string& idf_file, CWSSampler sampler, int fp_bits, const std::string& index_file,
+                    const std::string& builder_name, bool mono_active, SearchStrategy mono_strategy, int threads,
+                    bool accelerated, const PipelineOptions& pipeline_opts, const std::string& report_file, int top_n,
+                    long long mem_budget, const std::string& spill_dir, const VocabMap* vocab,
+                    double remap_seconds) {
+    BuildPipeline<WeightType, TF> pipeline([&](const std::vector<std::vector<int>>& docs) {
+        return makeBuilder<WeightType, TF>(docs, k, tokenNum, tf_strategy, idf_file, sampler, fp_bits, builder_name,
+                                           mono_active, mono_strategy, threads, accelerated);
+    }, pipeline_opts);
+    if (vocab) {
+        pipeline.setVocabMap(*vocab);
+    }
+    IndexWriter<WeightType> writer(k);
+    if (mem_budget > 0) {
+        writer.setMemoryBudget(mem_budget - pipeline_opts.held_cw_bytes, spill_dir);
+    }
+    BuildStats stats;
+
+    pipeline.run(src_file, writer, stats);
+    if (vocab) {
+        stats.addPhase("count_tokens", remap_seconds);
+    }
+    stats.addPhase("pipeline", pipeline.wallSeconds());
+    stats.addPhase("read", pipeline.readerUsage().busy);
+    stats.addPhase("build", pipeline.workerUsage().busy);
+    stats.addPhase("append", pipeline.writerUsage().busy);
+    cout << "Read and built " << writer.numDocs() << " documents" << endl;
+    cout << "Index Generation Time: " << pipeline.wallSeconds() << " s" << endl;
+    cout << "Index Size: " << writer.size() << endl;
+    BuildCounters total = stats.total();
+    cout << "Counters: keys=" << total.keys << " skipped=" << total.keys_skipped
+         << " searches=" << total.searches << " removals=" << total.removals
+         << " ranges=" << total.ranges << " cws=" << total.cws << endl;
+    pipeline.printUtilization(cout);
+
+    MemoryReport memory;
+    writer.reportMemory(memory);
+    memory.add("worker_scratch", pipeline.workerScratchBytes());
+    memory.print(cout);
+    printSpill(cout, writer.getSpill(), spill_dir);
+
+    if (!index_file.empty()) {
+        cout << "Saving index to: " << index_file << endl;
+        auto save_st = timerStart();
+        writer.write(index_file, pipeline.builder().getHasher());
+        stats.addPhase("save", timerCheck(save_st));
         cout << "Index saved successfully" << endl;
     }
+
+    if (!report_file.empty()) {
+        std::ofstream report(report_file);
+        if (!report.is_open()) {
+            throw std::runtime_error("Cannot open file for writing: " + report_file);
+        }
+        stats.writeJson(report, {}, top_n, &memory);
+        cout << "Build report written to: " << report_file << endl;
+    }
+}
+
+// A builder configuration tried by the planner.
+struct PlanCandidate {
+    std::string builder_name;
+    bool mono_active;
+    SearchStrategy mono_strategy;
+    bool accelerated;
+
+    std::string label() const {
+        if (builder_name == "monotonic") {
+            return std::string("monotonic -a ") + (mono_active ? "1" : "0") +
+                   (mono_strategy == SearchStrategy::BINARY_SEARCH ? " -s binary" : " -s linear");
+        }
+        return builder_name + (accelerated ? " -x" : "");
+    }
+};
+
+// Index a random sample of sample_num documents (in up to 8 disjoint contiguous
+// blocks read with loadSamples) with each candidate and extrapolate CW count and
+// build time to the full corpus.
+template<typename WeightType, typename TF>
+void planBuild(const std::string& src_file, int doc_num, int k, int tokenNum,
+               const std::string& tf_strategy, const std::string& idf_file, CWSSampler sampler,
+               int fp_bits, const PlanCandidate& selected, int sample_num, uint64_t seed) {
+    std::vector<int> lengths;
+    CorpusShape shape = scanCorpusShape(src_file, tokenNum, doc_num, &lengths);
+    cout << "Corpus: " << shape.docs << " documents, " << shape.tokens << " tokens" << endl;
+    if (shape.docs == 0) {
+        throw std::runtime_error("Corpus has no documents: " + src_file);
+    }
+
+    sample_num = (int)std::min<long long>(sample_num, shape.docs);
+    int blocks = std::min(8, sample_num);
+    int block_size = (sample_num + blocks - 1) / blocks;
+    std::vector<int> sizes;
+    for (int left = sample_num; left > 0; left -= block_size) sizes.push_back(std::min(block_size, left));
+    // Disjoint blocks: draw the gaps before each block as sorted offsets into
+    // the documents left over, then lay the blocks out after their gaps.
+    std::mt19937_64 rng(seed);
+    std::uniform_int_distribution<long long> pick_gap(0, shape.docs - sample_num);
+    std::vector<long long> gaps(sizes.size());
+    for (long long& g : gaps) g = pick_gap(rng);
+    std::sort(gaps.begin(), gaps.end());
+    std::vector<std::vector<int>> sample;
+    for (size_t b = 0; b < sizes.size(); b++) {
+        std::vector<std::vector<int>> block;
+        loadSamples(src_file, block, (int)(gaps[b] + (long long)sample.size()), sizes[b]);
+        for (auto& doc : block) sample.push_back(std::move(doc));
+    }
+
+    std::vector<PlanCandidate> candidates{selected};
+    for (const PlanCandidate& c : std::vector<PlanCandidate>{
+             {"monotonic", true, SearchStrategy::BINARY_SEARCH, false},
+             {"monotonic", true, SearchStrategy::LINEAR_SCAN, false},
+             {"monotonic", false, SearchStrategy::BINARY_SEARCH, false},
+             {"allalign", true, SearchStrategy::BINARY_SEARCH, true},
+             {"single", true, SearchStrategy::BINARY_SEARCH, true}}) {
+        if (c.label() != selected.label()) candidates.push_back(c);
+    }
+
+    BuildPlanner planner(sample, lengths, k, 4, 200, seed);
+    cout << "Planning on " << sample.size() << " sampled documents with " << planner.sampleK()
+         << " of " << k << " hash functions" << endl;
+    std::vector<PlanResult> results;
+    for (const PlanCandidate& c : candidates) {
+        auto builder = makeBuilder<WeightType, TF>(sample, planner.sampleK(), tokenNum, tf_strategy, idf_file,
+                                               sampler, fp_bits, c.builder_name, c.mono_active, c.mono_strategy, 1, c.accelerated);
+        results.push_back(planner.plan(c.label(), *builder));
+    }
+    results[0].name += " (selected)";
+
+    cout << "------------------------------" << endl;
+    BuildPlanner::print(cout, results);
+    int best = BuildPlanner::recommend(results);
+    cout << "------------------------------" << endl;
+    cout << "Recommended: " << candidates[best].label() << " (~" << (long long)std::ceil(results[best].seconds.mid)
+         << " s single-threaded, " << formatBytes(results[best].index_bytes) << " index)" << endl;
 }
 
 int main(int argc, char *argv[]) {
@@ -100,9 +336,33 @@ int main(int argc, char *argv[]) {
     bool mono_active = true;  // Default active=1
     SearchStrategy mono_strategy = SearchStrategy::BINARY_SEARCH;
     bool run_validation = false;
+    int threads = 1;
+    bool accelerated = false;
+    std::string report_file;
+    int top_n = 10;
+    bool estimate = false;
+    int plan_samples = 0;
+    std::string sampler_name = "ioffe";
+    int fp_bits = 0;
+    PipelineOptions pipeline_opts;
+    bool pipelined = false;
+    long long mem_budget = 0;
+    bool remap_vocab = false;
+
+    static struct option long_options[] = {
+        {"estimate", no_argument, nullptr, 'E'},
+        {"plan", required_argument, nullptr, 'P'},
+        {"sampler", required_argument, nullptr, 'S'},
+        {"fingerprint", required_argument, nullptr, 'F'},
+        {"pipeline", required_argument, nullptr, 'W'},
+        {"batch", required_argument, nullptr, 'D'},
+        {"mem-budget", required_argument, nullptr, 'M'},
+        {"remap-vocab", no_argument, nullptr, 'R'},
+        {nullptr, 0, nullptr, 0}
+    };
 
     int opt;
-    while ((opt = getopt(argc, argv, "f:n:k:i:l:t:I:v:B:a:s:V")) != EOF) {
+    while ((opt = getopt_long(argc, argv, "f:n:k:i:l:t:I:v:B:a:s:Vp:xj:N:", long_options, nullptr)) != EOF) {
         switch (opt) {
         case 'f':
             src_file = optarg;
@@ -141,6 +401,48 @@ int main(int argc, char *argv[]) {
         case 'V':
             run_validation = true;
             break;
+        case 'p':
+            threads = stoi(optarg);  // Worker threads (allalign only)
+            break;
+        case 'x':
+            accelerated = true;      // Cached-hash engine (allalign, single)
+            break;
+        case 'j':
+            report_file = optarg;    // JSON build report
+            break;
+        case 'N':
+            top_n = stoi(optarg);    // Slowest documents listed in the report
+            break;
+        case 'E':
+            estimate = true;         // Predict index size and memory, don't build
+            break;
+        case 'P':
+            plan_samples = stoi(optarg);  // Sampled documents for the planner, don't build
+            break;
+        case 'S':
+            sampler_name = optarg;   // ioffe or icws (DOUBLE only)
+            break;
+        case 'F':
+            fp_bits = stoi(optarg);  // Store 16/32-bit fingerprints instead of CW values (DOUBLE only)
+            break;
+        case 'W':
+            pipelined = true;        // Stream the corpus through reader / worker / writer stages
+            pipeline_opts.workers = stoi(optarg);
+            break;
+        case 'D':
+            pipeline_opts.batch_docs = stoi(optarg);  // Documents per pipeline batch
+            break;
+        case 'R':
+            remap_vocab = true;      // Renumber the corpus's tokens densely, most frequent first
+            break;
+        case 'M':
+            try {
+                mem_budget = parseByteSize(optarg);  // Bytes of CWs kept in memory; the rest spills
+            } catch (const std::exception& e) {
+                std::cerr << "Error: --mem-budget: " << e.what() << std::endl;
+                return 1;
+            }
+            break;
         case 'I':
             idf_file = optarg;     // Path to IDF file
             break;
@@ -156,7 +458,8 @@ int main(int argc, char *argv[]) {
             std::cout << "  -k <num>      Number of hash functions" << std::endl;
             std::cout << std::endl;
             std::cout << "Optional:" << std::endl;
-            std::cout << "  -i <file>     Output index file path (if not specified, won't save to disk)" << std::endl;
+            std::cout << "  -i <file>     Output index file path (if not specified, won't save to disk); also" << std::endl;
+            std::cout << "                writes <data.bin>.offsets, the document offsets query -C uses" << std::endl;
             std::cout << "  -n <num>      Limit number of documents (0=all)" << std::endl;
             std::cout << "  -l <num>      Document length limit (0=no limit)" << std::endl;
             std::cout << "  -t <strategy> TF weighting: raw (default), log, boolean, augmented, square" << std::endl;
@@ -164,8 +467,26 @@ int main(int argc, char *argv[]) {
             std::cout << "  -a <0|1>      Monotonic active-key optimization (monotonic only; default 1)" << std::endl;
             std::cout << "  -s <binary|linear> Monotonic search strategy (monotonic only; default binary)" << std::endl;
             std::cout << "  -V             Run in-memory validation after building (debug)" << std::endl;
+            std::cout << "  -p <num>      Worker threads for long documents (allalign only; default 1)" << std::endl;
+            std::cout << "  -x            Accelerated engine with identical output (allalign, single)" << std::endl;
+            std::cout << "  -j <file>     Write a JSON build report (phase times, counters, slowest documents)" << std::endl;
+            std::cout << "  -N <num>      Slowest documents listed in the report (default: 10)" << std::endl;
             std::cout << "  -I <file>     Load IDF weights from file" << std::endl;
             std::cout << "  -v <num>      Vocabulary size (default: 50257 for GPT-2)" << std::endl;
+            std::cout << "  --estimate    Predict index size and peak memory for -f/-n/-k/-B and exit" << std::endl;
+            std::cout << "  --plan <num>  Build a sample of <num> documents with each builder, extrapolate" << std::endl;
+            std::cout << "                CW count and build time to the corpus, recommend one and exit" << std::endl;
+            std::cout << "  --sampler <name> CWS variant for DOUBLE weights: ioffe (default) or icws;" << std::endl;
+            std::cout << "                stored in the index and used by query" << std::endl;
+            std::cout << "  --fingerprint <16|32> Store a 16- or 32-bit fingerprint of each CW value instead" << std::endl;
+            std::cout << "                of the double (DOUBLE only); query -C rechecks matches" << std::endl;
+            std::cout << "  --pipeline <num> Stream the corpus in batches through <num> builder threads," << std::endl;
+            std::cout << "                overlapping reading, building and collecting; reports stage use" << std::endl;
+            std::cout << "  --batch <num> Documents per pipeline batch (default: 64)" << std::endl;
+            std::cout << "  --mem-budget <size> Keep at most <size> (e.g. 512M, 2G) of CWs in memory, spilling" << std::endl;
+            std::cout << "                full runs to a temporary file next to the index" << std::endl;
+            std::cout << "  --remap-vocab Renumber the tokens the corpus uses densely, most frequent first, for" << std::endl;
+            std::cout << "                cache-friendly per-token tables; stored in the index, applied by query" << std::endl;
             return 0;
         }
     }
@@ -191,6 +512,63 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    bool need_double = (tf_strategy != "raw") || !idf_file.empty();
+    CWSSampler sampler;
+    try {
+        sampler = parseCWSSampler(sampler_name);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    if (sampler != CWSSampler::IOFFE && !need_double) {
+        std::cerr << "Error: --sampler applies to DOUBLE weights; use -t other than raw or -I." << std::endl;
+        return 1;
+    }
+    if (fp_bits != 0 && fp_bits != 16 && fp_bits != 32) {
+        std::cerr << "Error: --fingerprint must be 16 or 32." << std::endl;
+        return 1;
+    }
+    if (fp_bits && !need_double) {
+        std::cerr << "Error: --fingerprint applies to DOUBLE weights; INT CW values are already 4 bytes." << std::endl;
+        return 1;
+    }
+
+    if (pipelined && (doc_length != 0 || run_validation)) {
+        std::cerr << "Error: --pipeline streams whole documents; it does not support -l or -V." << std::endl;
+        return 1;
+    }
+    if (top_n < 0) {
+        std::cerr << "Error: -N must not be negative." << std::endl;
+        return 1;
+    }
+    if (pipelined && (pipeline_opts.workers < 1 || pipeline_opts.batch_docs < 1)) {
+        std::cerr << "Error: --pipeline and --batch must be positive." << std::endl;
+        return 1;
+    }
+    pipeline_opts.doc_limit = doc_num;
+    if (mem_budget > 0 && run_validation) {
+        std::cerr << "Error: -V needs every CW in memory; it does not combine with --mem-budget." << std::endl;
+        return 1;
+    }
+    long long min_budget = need_double ? CWSpill<double>::minBudget(k) : CWSpill<int>::minBudget(k);
+    if (pipelined) {
+        // Half for the writer's lists, half for finished batches waiting on it
+        min_budget *= 2;
+        pipeline_opts.held_cw_bytes = mem_budget / 2;
+    }
+    if (mem_budget > 0 && mem_budget < min_budget) {
+        std::cerr << "Error: --mem-budget must be at least " << formatBytes(min_budget) << " for " << k
+                  << " hash functions" << (pipelined ? " with --pipeline" : "") << "." << std::endl;
+        return 1;
+    }
+    // Spill next to the index, which has room for it, rather than in a /tmp
+    // that may be memory-backed.
+    std::string spill_dir = ".";
+    if (index_file.find('/') != std::string::npos) {
+        spill_dir = index_file.substr(0, index_file.rfind('/'));
+        if (spill_dir.empty()) spill_dir = "/";
+    }
+
     std::cout << "Parameters Summary: \n";
     std::cout << "bin_file_path  : " << src_file << "\n";
     std::cout << "doc_num        : " << doc_num << "\n";
@@ -199,13 +577,109 @@ int main(int argc, char *argv[]) {
     std::cout << "tokenNum       : " << tokenNum << "\n";
     std::cout << "tf_strategy    : " << tf_strategy << "\n";
     std::cout << "idf_file       : " << idf_file << "\n";
+    if (need_double) {
+        std::cout << "sampler        : " << cwsSamplerName(sampler) << "\n";
+        std::cout << "fingerprint    : " << (fp_bits ? std::to_string(fp_bits) + "-bit" : "off") << "\n";
+    }
     std::cout << "builder        : " << builder_name << "\n";
     if (builder_name == "monotonic") {
         std::cout << "mono_active    : " << (mono_active ? 1 : 0) << "\n";
         std::cout << "mono_strategy  : " << (mono_strategy == SearchStrategy::BINARY_SEARCH ? "binary" : "linear") << "\n";
     }
+    if (builder_name == "allalign") {
+        std::cout << "threads        : " << threads << "\n";
+    }
+    if (builder_name != "monotonic") {
+        std::cout << "accelerated    : " << (accelerated ? 1 : 0) << "\n";
+    }
+    if (remap_vocab) {
+        std::cout << "remap_vocab    : 1\n";
+    }
+    if (mem_budget > 0) {
+        std::cout << "mem_budget     : " << formatBytes(mem_budget) << " (spill to " << spill_dir << ")\n";
+    }
+    if (pipelined) {
+        std::cout << "pipeline       : " << pipeline_opts.workers << " workers, batches of "
+                  << pipeline_opts.batch_docs << "\n";
+    }
     std::cout << "------------------------------" << std::endl;
 
+    if (estimate) {
+        if (doc_length != 0) {
+            std::cout << "Note: -l is ignored by --estimate" << std::endl;
+        }
+        try {
+            CorpusShape shape = scanCorpusShape(src_file, tokenNum, doc_num);
+            EstimateOptions options;
+            options.mem_budget = mem_budget;
+            options.pipeline_workers = pipelined ? pipeline_opts.workers : 0;
+            options.batch_docs = pipeline_opts.batch_docs;
+            options.queue_batches = pipeline_opts.queue_batches;
+            options.remap_vocab = remap_vocab;
+            IndexEstimate e = estimateIndex(shape, k, tokenNum, builder_name, need_double, !idf_file.empty(), fp_bits,
+                                            options);
+            printEstimate(cout, shape, e);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (plan_samples > 0) {
+        PlanCandidate selected{builder_name, mono_active, mono_strategy, accelerated};
+        try {
+            if (need_double) {
+                withTFPolicy(parseTFMode(tf_strategy), [&](auto tf) {
+                    planBuild<double, decltype(tf)>(src_file, doc_num, k, tokenNum, tf_strategy, idf_file, sampler,
+                                                    fp_bits, selected, plan_samples, 1);
+                });
+            } else {
+                planBuild<int, RawTF>(src_file, doc_num, k, tokenNum, tf_strategy, idf_file, sampler,
+                                      fp_bits, selected, plan_samples, 1);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (pipelined) {
+        try {
+            VocabMap vocab;
+            double remap_seconds = 0;
+            if (remap_vocab) {
+                auto remap_st = timerStart();
+                vocab = VocabMap::byFrequency(countCorpusOccurrences(src_file, doc_num, tokenNum));
+                remap_seconds = timerCheck(remap_st);
+                printVocabMap(cout, vocab, remap_seconds);
+            }
+            const VocabMap* vocab_ptr = remap_vocab ? &vocab : nullptr;
+            if (need_double) {
+                cout << "=== Running in DOUBLE mode (pipelined) ===" << endl;
+                withTFPolicy(parseTFMode(tf_strategy), [&](auto tf) {
+                    buildPipelined<double, decltype(tf)>(src_file, k, tokenNum, tf_strategy, idf_file, sampler, fp_bits,
+                                                         index_file, builder_name, mono_active, mono_strategy, threads,
+                                                         accelerated, pipeline_opts, report_file, top_n, mem_budget,
+                                                         spill_dir, vocab_ptr, remap_seconds);
+                });
+            } else {
+                cout << "=== Running in INT mode (pipelined) ===" << endl;
+                buildPipelined<int, RawTF>(src_file, k, tokenNum, tf_strategy, idf_file, sampler, fp_bits, index_file,
+                                           builder_name, mono_active, mono_strategy, threads, accelerated,
+                                           pipeline_opts, report_file, top_n, mem_budget, spill_dir, vocab_ptr,
+                                           remap_seconds);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        if (!index_file.empty()) writeCorpusOffsets(src_file, doc_num);
+        cout << "Peak RSS: " << formatBytes(peakRSSBytes()) << endl;
+        return 0;
+    }
+
     auto load_st = timerStart();
     vector<vector<int>> docs;
     if (doc_num == 0) {
@@ -216,18 +690,41 @@ int main(int argc, char *argv[]) {
         else
             loadBin(src_file, docs, doc_num, doc_length);
     }
-    cout << "Load Time: " << timerCheck(load_st) << " s\n";
+    double load_seconds = timerCheck(load_st);
+    cout << "Load Time: " << load_seconds << " s\n";
+    // -l joins documents into chunks, and only together with -n
+    int chunk_length = doc_num != 0 ? doc_length : 0;
     
     // Select weight type automatically
-    bool need_double = (tf_strategy != "raw") || !idf_file.empty();
-    
-    if (need_double) {
-        cout << "=== Running in DOUBLE mode ===" << endl;
-        buildAndSaveIndex<double>(docs, k, tokenNum, tf_strategy, idf_file, index_file, builder_name, mono_active, mono_strategy, run_validation);
-    } else {
-        cout << "=== Running in INT mode (optimized) ===" << endl;
-        buildAndSaveIndex<int>(docs, k, tokenNum, tf_strategy, idf_file, index_file, builder_name, mono_active, mono_strategy, run_validation);
+    try {
+        VocabMap vocab;
+        double remap_seconds = 0;
+        auto remap_st = timerStart();
+        if (remap_vocab) {
+            vocab = VocabMap::byFrequency(VocabMap::countOccurrences(docs, tokenNum));
+            vocab.remap(docs);
+            remap_seconds = timerCheck(remap_st);
+            printVocabMap(cout, vocab, remap_seconds);
+        } else {
+            checkTokens(docs, tokenNum);
+        }
+        const VocabMap* vocab_ptr = remap_vocab ? &vocab : nullptr;
+        if (need_double) {
+            cout << "=== Running in DOUBLE mode ===" << endl;
+            // Dispatch the TF mode once; builders are specialized on it.
+            withTFPolicy(parseTFMode(tf_strategy), [&](auto tf) {
+                buildAndSaveIndex<double, decltype(tf)>(docs, k, tokenNum, tf_strategy, idf_file, sampler, fp_bits, index_file, builder_name, mono_active, mono_strategy, run_validation, threads, accelerated, report_file, top_n, load_seconds, mem_budget, spill_dir, vocab_ptr, remap_seconds, chunk_length);
+            });
+        } else {
+            cout << "=== Running in INT mode (optimized) ===" << endl;
+            buildAndSaveIndex<int, RawTF>(docs, k, tokenNum, tf_strategy, idf_file, sampler, fp_bits, index_file, builder_name, mono_active, mono_strategy, run_validation, threads, accelerated, report_file, top_n, load_seconds, mem_budget, spill_dir, vocab_ptr, remap_seconds, chunk_length);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
     }
+    // -l documents are chunks, which the corpus offsets do not describe
+    if (!index_file.empty() && chunk_length == 0) writeCorpusOffsets(src_file, doc_num);
 
     return 0;
 }
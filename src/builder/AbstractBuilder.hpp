@@ -2,46 +2,129 @@
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <stdexcept>
+#include <memory>
 #include "../util/cw.hpp"
+#include "../util/cw_columns.hpp"
+#include "../util/cw_spill.hpp"
 #include "../util/hasher.hpp"
+#include "../util/index_utils.hpp"
+#include "../util/doc_weights.hpp"
 #include "../util/tf_strategy.hpp"
+#include "../util/build_stats.hpp"
+#include "../util/memory.hpp"
+#include "../util/util.hpp"
 
 using namespace std;
 
-template<typename WeightType>
+template<typename WeightType, typename TF = DynamicTF>
 class AbstractBuilder {
+    static_assert(TF::template supports<WeightType>,
+                  "INT WeightType is only allowed with raw TF; use DOUBLE for other TF modes");
+
 protected:
     int k, tokenNum;
     const std::vector<std::vector<int>> &docs;
     std::vector<std::vector<CW<WeightType>>> cws;
     Hasher<WeightType> hasher;
     TFMode tf_mode;
+    BuildStats stats;
+    std::unique_ptr<CWSpill<WeightType>> spill;   // set under a memory budget
+    uint64_t chunk_length = 0;   // build -l; 0 = docs are corpus documents
+
+    // Fold a (hash function, document) step's counters into the stats, and
+    // spill cws[hid] if the step filled it. Builders call this after each
+    // step, once the step's CWs are all in cws[hid].
+    void recordStep(int hid, int doc_id, const BuildCounters &ctr) {
+        stats.record(hid, doc_id, ctr);
+        if (spill && spill->full(hid, cws[hid])) {
+            spill->spill(hid, cws[hid]);
+        }
+    }
 
 public:
     AbstractBuilder(const std::vector<std::vector<int>> &docs_, int k_, int tokenNum_)
-        : k(k_), tokenNum(tokenNum_), docs(docs_), cws(k_), hasher(k_, tokenNum_), tf_mode(TFMode::RAW) {}
+        : k(k_), tokenNum(tokenNum_), docs(docs_), cws(k_), hasher(k_, tokenNum_), tf_mode(TFMode::RAW) {
+        if constexpr (TF::is_static) {
+            setTFMode(TF::mode);
+        }
+    }
 
     virtual ~AbstractBuilder() {}
     virtual void buildCW() = 0;
 
     void setTFMode(TFMode mode) { 
+        if constexpr (TF::is_static) {
+            if (mode != TF::mode) {
+                throw std::invalid_argument("TF mode does not match the builder's compile-time TF policy");
+            }
+        }
         tf_mode = mode; 
         hasher.setTFMode(mode);
     }
+    void setSampler(CWSSampler sampler) { hasher.setSampler(sampler); }
+    void setFingerprintBits(int bits) { hasher.setFingerprintBits(bits); }
+    // Documents are build -l chunks of this many corpus tokens; recorded in
+    // the index so query -C does not take them for corpus documents.
+    void setChunkLength(int length) { chunk_length = length; }
+    int fingerprintBits() const { return hasher.fingerprintBits(); }
     void loadIDF(const std::string& file) { hasher.loadIDF(file); }
+
+    // Keep at most about budget_bytes of CWs in memory, spilling the rest to
+    // a temporary file in spill_dir until saveIndex. Set before buildCW.
+    void setMemoryBudget(long long budget_bytes, const std::string &spill_dir) {
+        spill = std::make_unique<CWSpill<WeightType>>(k, budget_bytes, spill_dir);
+        for (auto &list : cws) spill->reserve(list);
+    }
+    const CWSpill<WeightType> *getSpill() const { return spill.get(); }
     void calculateIDF() { hasher.calculateIDF(docs); }
+    // docs must already be in the map's dense ids; set after loadIDF.
+    void setVocabMap(const VocabMap &map) { hasher.setVocabMap(map); }
 
     WeightType calculateTF(int freq, int max_freq = 0) const {
-        return TFCalculator<WeightType>::calculate(tf_mode, freq, max_freq);
+        return TF::template weight<WeightType>(tf_mode, freq, max_freq);
+    }
+
+    // TF (and fused TF-IDF) weights of doc, computed once and shared by all
+    // hash functions. cnt is tokenNum-sized zeroed scratch.
+    void prepareWeights(const std::vector<int> &doc, DocWeights<WeightType> &weights, std::vector<int> &cnt) const {
+        weights.build(doc, cnt, hasher, [&](int x, int max_freq) { return calculateTF(x, max_freq); });
     }
 
     const std::vector<std::vector<CW<WeightType>>> &getCWs() const {
         return cws;
     }
 
+    // Move the CWs built so far out (per hash function), leaving the builder
+    // empty for the next run of buildCW over refilled docs.
+    std::vector<std::vector<CW<WeightType>>> takeCWs() {
+        std::vector<std::vector<CW<WeightType>>> out(k);
+        out.swap(cws);
+        return out;
+    }
+
+    const Hasher<WeightType> &getHasher() const { return hasher; }
+
+    // Bytes held by the corpus, the CW vectors and the IDF table. Builders
+    // extend this with their scratch arrays.
+    virtual void reportMemory(MemoryReport &report) const {
+        report.add("corpus", corpusBytes(docs));
+        long long used = 0, reserved = 0;
+        for (const auto &list : cws) {
+            used += (long long)list.size() * sizeof(CW<WeightType>);
+            reserved += vectorBytes(list);
+        }
+        report.add("cws", used, reserved);
+        report.add("idf", hasher.idfBytes());
+        if (!hasher.vocabMap().empty()) report.add("vocab", hasher.vocabBytes());
+    }
+
+    BuildStats &getStats() { return stats; }
+    const BuildStats &getStats() const { return stats; }
+
     long long getSize() const {
-        long long sum = 0;
+        long long sum = spill ? spill->spilledCWs() : 0;
         for (int i = 0; i < k; i++) {
             sum += cws[i].size();
         }
@@ -52,29 +135,21 @@ public:
         return hasher.getModeInfo();
     }
 
+    // Spilled CWs are copied from the spill file ahead of each block's CWs
+    // still in memory.
     void saveIndex(const std::string& filename) const {
-        std::ofstream file(filename, std::ios::binary);
-        if (!file.is_open()) {
-            throw std::runtime_error("Cannot open file for writing: " + filename);
-        }
-        
-        // Save basic parameters
-        file.write(reinterpret_cast<const char*>(&k), sizeof(k));
-        file.write(reinterpret_cast<const char*>(&tokenNum), sizeof(tokenNum));
-        
-        // Save hasher configuration (TF mode, IDF data)
-        hasher.saveToFile(file);
-        
-        // Save CWs
-        for (int hid = 0; hid < k; hid++) {
-            size_t cw_count = cws[hid].size();
-            file.write(reinterpret_cast<const char*>(&cw_count), sizeof(cw_count));
-            for (const auto& cw : cws[hid]) {
-                cw.saveToFile(file);
+        int fp_bits = hasher.fingerprintBits();
+        writeIndexFile(filename, hasher, docs.size(), chunk_length,
+                       [&](int hid) { return cws[hid].size() + (spill ? spill->spilledCWs(hid) : 0); },
+                       [&](int hid, std::ofstream &out, Checksum &sum) {
+            if (spill) {
+                spill->copyBlock(hid, cws[hid], out, sum, fp_bits);
+            } else if (fp_bits) {
+                CWColumns<WeightType>::writeFingerprintRecords(out, cws[hid].data(), cws[hid].size(), fp_bits, &sum);
+            } else {
+                CWColumns<WeightType>::writeRecords(out, cws[hid].data(), cws[hid].size(), &sum);
             }
-        }
-        
-        file.close();
+        });
     }
 
     void loadIndex(const std::string& filename) {
@@ -82,31 +157,33 @@ public:
         if (!file.is_open()) {
             throw std::runtime_error("Cannot open file for reading: " + filename);
         }
-        
-        // Load basic parameters
-        file.read(reinterpret_cast<char*>(&k), sizeof(k));
-        file.read(reinterpret_cast<char*>(&tokenNum), sizeof(tokenNum));
-        
-        // Resize CWs vector
+
+        // Load hasher configuration and the block table
+        IndexLayout layout = readIndexLayout(file, hasher, filename);
+        if (hasher.fingerprintBits()) {
+            throw std::runtime_error("Fingerprinted index has no CW values to load into a builder: " + filename);
+        }
+        k = hasher.getK();
+        tokenNum = hasher.getTokenNum();
         cws.resize(k);
-        
-        // Load hasher configuration
-        hasher.loadFromFile(file);
-        
+
         // Load CWs
         for (int hid = 0; hid < k; hid++) {
-            size_t cw_count;
-            file.read(reinterpret_cast<char*>(&cw_count), sizeof(cw_count));
-            cws[hid].resize(cw_count);
-            for (auto& cw : cws[hid]) {
-                cw.loadFromFile(file);
-            }
+            const IndexBlock &b = layout.blocks[hid];
+            file.seekg(b.offset);
+            cws[hid].resize(b.count);
+            Checksum sum;
+            CWColumns<WeightType>::readRecords(file, cws[hid].data(), b.count, &sum);
+            layout.verifyBlock(hid, sum, filename);
         }
-        
+
         file.close();
     }
 
     void validation() {
+        if (spill && spill->spilledCWs() > 0) {
+            throw std::runtime_error("Validation needs all CWs in memory; they were spilled under the memory budget");
+        }
         for (int tid = 0; tid < docs.size(); tid++) {
             int n = docs[tid].size();
             for (int hid = 0; hid < k; hid++) {
@@ -2,146 +2,351 @@
 
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <thread>
 #include "AbstractBuilder.hpp"
+#include "../util/rank_hash.hpp"
 
-template<typename WeightType>
-class AllAlignBuilder : public AbstractBuilder<WeightType> {
-    using Base = AbstractBuilder<WeightType>;
+template<typename WeightType, typename TF = DynamicTF>
+class AllAlignBuilder : public AbstractBuilder<WeightType, TF> {
+    using Base = AbstractBuilder<WeightType, TF>;
     using Base::k;
     using Base::tokenNum;
     using Base::docs;
     using Base::cws;
     using Base::hasher;
-    using Base::calculateTF;
+    using Base::prepareWeights;
+    using Base::stats;
+    using Base::recordStep;
 
 private:
-    vector<int> first, next, rnext, freq;
-    int max_freq; // Cache max frequency to avoid recalculation
+    // One pending range of the AllAlign recursion: minimum over [l, r], with
+    // window starts limited to [l, le].
+    struct Task {
+        int l, le, r;
+    };
 
-    void work(int l, int le, int r, int hid, int doc_id, const std::vector<int> &doc)
+    // Per-thread scratch. cnt holds the token counts of the cached prefix
+    // frame [frameL, frameR]: arg[i - frameL] / rank[i - frameL] are the
+    // position and local count of the minimum of [frameL, i].
+    struct Scratch {
+        std::vector<int> cnt;
+        int frameL = -1, frameR = -1;
+        WeightType frameMin{};
+        std::vector<int> arg, rank;
+
+        explicit Scratch(int tokenNum) : cnt(tokenNum, 0) {}
+    };
+
+    // Ranges at least this long are worth handing to another thread.
+    static constexpr int kParallelGrain = 2048;
+
+    vector<int> first, next, rnext;
+    Scratch scratch;
+    DocWeights<WeightType> weights;
+    RankHashTable<WeightType> ranks;
+    int threads;
+    bool rmq;
+
+    // Scan [l, r] with the hasher. Returns the position of the first minimum
+    // and its count within the range.
+    void scanMin(int l, int r, int hid, const std::vector<int> &doc, std::vector<int> &cnt,
+                 int &c, int &x, WeightType &mn)
     {
-        if (r < l)
-        {
-            return;
-        }
-        int a, b, c = 0, x;
-        WeightType mn;
-        
+        c = -1;
         // Find minimum hash value in range [l, r]
         for (int i = l; i <= r; i++)
         {
-            freq[doc[i]]++;
-            WeightType tf = calculateTF(freq[doc[i]], max_freq);
-            WeightType v = hasher.eval(hid, doc[i], tf);
-            if (c == 0 || v < mn)
+            cnt[doc[i]]++;
+            WeightType v = hasher.evalWeighted(hid, doc[i], weights.weight(doc[i], cnt[doc[i]]));
+            if (c < 0 || v < mn)
             {
                 mn = v;
                 c = i;
-                x = freq[doc[i]];
+                x = cnt[doc[i]];
             }
         }
-        
+
         // Reset frequency counts
         for (int i = l; i <= r; i++)
         {
-            freq[doc[i]]--;
+            cnt[doc[i]]--;
+        }
+    }
+
+    void dropFrame(Scratch &s, const std::vector<int> &doc)
+    {
+        for (int i = s.frameL; i <= s.frameR && s.frameL >= 0; i++)
+        {
+            s.cnt[doc[i]]--;
         }
-        
+        s.frameL = s.frameR = -1;
+    }
+
+    // Same answer as scanMin, read from the prefix-minimum frame of l. Ranges
+    // sharing a left bound (every first subrange does) reuse the frame, and
+    // extending it only looks up precomputed rank hashes.
+    void frameMin(Scratch &s, int l, int r, const std::vector<int> &doc,
+                  int &c, int &x, WeightType &mn)
+    {
+        if (s.frameL != l)
+        {
+            dropFrame(s, doc);
+            s.frameL = l;
+            s.frameR = l - 1;
+            s.arg.clear();
+            s.rank.clear();
+        }
+        for (int i = s.frameR + 1; i <= r; i++)
+        {
+            int cx = ++s.cnt[doc[i]];
+            WeightType v = ranks.value(doc[i], cx);
+            if (i == l || v < s.frameMin)
+            {
+                s.frameMin = v;
+                s.arg.push_back(i);
+                s.rank.push_back(cx);
+            }
+            else
+            {
+                s.arg.push_back(s.arg.back());
+                s.rank.push_back(s.rank.back());
+            }
+        }
+        s.frameR = std::max(s.frameR, r);
+        c = s.arg[r - l];
+        x = s.rank[r - l];
+        mn = ranks.value(doc[c], x);
+    }
+
+    // Expand one range: emit its CWs into out and push the subranges that the
+    // recursive formulation would have visited onto stack.
+    void work(const Task &task, int hid, int doc_id, const std::vector<int> &doc,
+              Scratch &s, std::vector<CW<WeightType>> &out, std::vector<Task> &stack)
+    {
+        const int l = task.l, le = task.le, r = task.r;
+        if (r < l)
+        {
+            return;
+        }
+        int a, b, c, x = 0;
+        WeightType mn{};
+        if (rmq)
+        {
+            frameMin(s, l, r, doc, c, x, mn);
+        }
+        else
+        {
+            scanMin(l, r, hid, doc, s.cnt, c, x, mn);
+        }
+
+        // Subranges are popped in the order the recursion visited them, which
+        // keeps runs of ranges with the same left bound together.
+        size_t mark = stack.size();
+
         // Find the leftmost occurrence of the same token
         b = c;
         while (rnext[b] >= l)
         {
             b = rnext[b];
         }
-        
+
         // Generate compressed windows
         while (c <= r)
         {
             a = std::max(rnext[b] + 1, l);
             if (le > b)
             {
-                cws[hid].emplace_back(doc_id, mn, a, b, c, r);
+                out.emplace_back(doc_id, mn, a, b, c, r);
                 if (x == 1)
                 {
-                    work(a, b - 1, c - 1, hid, doc_id, doc);
+                    stack.push_back({a, b - 1, c - 1});
                 }
                 else
                 {
-                    work(a, b, c - 1, hid, doc_id, doc);
+                    stack.push_back({a, b, c - 1});
                 }
             }
             else
             {
-                cws[hid].emplace_back(doc_id, mn, a, le, c, r);
-                work(a, le, c - 1, hid, doc_id, doc);
-                return;
+                out.emplace_back(doc_id, mn, a, le, c, r);
+                stack.push_back({a, le, c - 1});
+                break;
             }
             if (next[c] > r)
             {
-                work(b + 1, le, r, hid, doc_id, doc);
-                return;
+                stack.push_back({b + 1, le, r});
+                break;
             }
             b = next[b];
             c = next[c];
         }
+        std::reverse(stack.begin() + mark, stack.end());
+    }
+
+    // Expand ranges until none are left. Returns the number of ranges expanded.
+    long long drain(std::vector<Task> &stack, int hid, int doc_id, const std::vector<int> &doc,
+                    Scratch &s, std::vector<CW<WeightType>> &out)
+    {
+        long long expanded = 0;
+        while (!stack.empty())
+        {
+            Task task = stack.back();
+            stack.pop_back();
+            work(task, hid, doc_id, doc, s, out, stack);
+            expanded++;
+        }
+        dropFrame(s, doc);
+        return expanded;
+    }
+
+    // Split the largest ranges inline until every thread has several to chew
+    // on, then drain them in parallel. Each range owns its output so the CW
+    // order does not depend on scheduling.
+    long long workParallel(int hid, int doc_id, const std::vector<int> &doc)
+    {
+        int n = (int)doc.size();
+        std::atomic<long long> expanded{0};
+        std::vector<Task> pending{{0, n - 1, n - 1}};
+        auto span = [](const Task &t) { return t.r - t.l + 1; };
+        while ((int)pending.size() < 4 * threads)
+        {
+            auto largest = std::max_element(pending.begin(), pending.end(),
+                                            [&](const Task &lhs, const Task &rhs) { return span(lhs) < span(rhs); });
+            if (largest == pending.end() || span(*largest) < kParallelGrain)
+            {
+                break;
+            }
+            Task task = *largest;
+            pending.erase(largest);
+            work(task, hid, doc_id, doc, scratch, cws[hid], pending);
+            expanded++;
+        }
+        dropFrame(scratch, doc);
+        std::sort(pending.begin(), pending.end(),
+                  [&](const Task &lhs, const Task &rhs) { return span(lhs) > span(rhs); });
+
+        std::vector<std::vector<CW<WeightType>>> outs(pending.size());
+        std::atomic<size_t> cursor{0};
+        auto worker = [&]() {
+            Scratch local(tokenNum);
+            std::vector<Task> stack;
+            for (size_t t = cursor++; t < pending.size(); t = cursor++)
+            {
+                stack.push_back(pending[t]);
+                expanded += drain(stack, hid, doc_id, doc, local, outs[t]);
+            }
+        };
+        std::vector<std::thread> pool;
+        for (int t = 1; t < threads; t++)
+        {
+            pool.emplace_back(worker);
+        }
+        worker();
+        for (auto &th : pool)
+        {
+            th.join();
+        }
+        for (auto &out : outs)
+        {
+            cws[hid].insert(cws[hid].end(), out.begin(), out.end());
+        }
+        return expanded;
     }
 
 public:
-    AllAlignBuilder(const std::vector<std::vector<int>> &docs_, int k_, int tokenNum_)
+    AllAlignBuilder(const std::vector<std::vector<int>> &docs_, int k_, int tokenNum_,
+                    int threads_ = 1, bool rmq_ = false)
         : Base(docs_, k_, tokenNum_),
           first(tokenNum_),
-          freq(tokenNum_)
+          scratch(tokenNum_),
+          weights(tokenNum_),
+          ranks(tokenNum_),
+          threads(std::max(1, threads_)),
+          rmq(rmq_)
     {
     }
-          
+
+    void reportMemory(MemoryReport &report) const override {
+        Base::reportMemory(report);
+        report.add("scratch", vectorBytes(first) + vectorBytes(next) + vectorBytes(rnext) +
+                              vectorBytes(scratch.cnt) + vectorBytes(scratch.arg) + vectorBytes(scratch.rank));
+        report.add("doc_weights", weights.memoryBytes());
+        report.add("rank_hashes", ranks.memoryBytes());
+    }
+
+    // Documents outer, hash functions inner: weights, rank rows and the
+    // next pointers are prepared once per document, and each cws[hid] still
+    // lists documents in order. The preparation time is split evenly over
+    // the k steps.
     void buildCW() override {
-        for (int hid = 0; hid < k; hid++)
+        std::vector<Task> stack;
+        stats.reset(k, docs.size());
+        for (int doc_id = 0; doc_id < (int)docs.size(); doc_id++)
         {
-            for (int doc_id = 0; doc_id < (int)docs.size(); doc_id++)
+            const std::vector<int> &doc = docs[doc_id];
+            int n = (int)doc.size();
+            if (n == 0)
             {
-                const std::vector<int> &doc = docs[doc_id];
-                int n = (int)doc.size();
-                next.reserve(n + 1);
-                rnext.reserve(n + 1);
-
-                // Calculate max frequency once per document
-                max_freq = 0;
-                for (int i = 0; i < n; i++) {
-                    freq[doc[i]] = 0;
-                }
-                for (int i = 0; i < n; i++) {
-                    freq[doc[i]]++;
-                    max_freq = std::max(max_freq, freq[doc[i]]);
-                }
-                for (int i = 0; i < n; i++) {
-                    freq[doc[i]] = 0;
-                }
+                continue;
+            }
+            auto prep_st = timerStart();
+            next.resize(n + 1);
+            rnext.resize(n + 1);
 
-                // Build reverse next pointers
-                for (int i = 0; i < n; i++)
-                {
-                    first[doc[i]] = -1;
-                }
-                for (int i = 0; i < n; i++)
+            prepareWeights(doc, weights, scratch.cnt);
+            if (rmq)
+            {
+                ranks.index(doc, scratch.cnt);
+            }
+
+            // Build reverse next pointers
+            for (int i = 0; i < n; i++)
+            {
+                first[doc[i]] = -1;
+            }
+            for (int i = 0; i < n; i++)
+            {
+                rnext[i] = first[doc[i]];
+                first[doc[i]] = i;
+            }
+
+            // Build forward next pointers
+            for (int i = 0; i < n; i++)
+            {
+                first[doc[i]] = n;
+            }
+            next[n] = n;
+            for (int i = n - 1; i >= 0; i--)
+            {
+                next[i] = first[doc[i]];
+                first[doc[i]] = i;
+            }
+            double prep = timerCheck(prep_st) / k;
+
+            for (int hid = 0; hid < k; hid++)
+            {
+                BuildCounters ctr;
+                auto step_st = timerStart();
+                size_t emitted = cws[hid].size();
+                if (rmq)
                 {
-                    rnext[i] = first[doc[i]];
-                    first[doc[i]] = i;
+                    ranks.evaluate(hasher, hid, doc, weights);
                 }
 
-                // Build forward next pointers  
-                for (int i = 0; i < n; i++)
+                if (threads > 1 && n >= kParallelGrain)
                 {
-                    first[doc[i]] = n;
+                    ctr.ranges = workParallel(hid, doc_id, doc);
                 }
-                next[n] = n;
-                for (int i = n - 1; i >= 0; i--)
+                else
                 {
-                    next[i] = first[doc[i]];
-                    first[doc[i]] = i;
+                    stack.push_back({0, n - 1, n - 1});
+                    ctr.ranges = drain(stack, hid, doc_id, doc, scratch, cws[hid]);
                 }
-                
-                work(0, n - 1, n - 1, hid, doc_id, doc);
+                ctr.cws = cws[hid].size() - emitted;
+                ctr.seconds = timerCheck(step_st) + prep;
+                recordStep(hid, doc_id, ctr);
             }
         }
     }
-};
\ No newline at end of file
+};
@@ -0,0 +1,330 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <map>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <fstream>
+#include <ostream>
+#include <iomanip>
+#include <stdexcept>
+#include "AbstractBuilder.hpp"
+#include "../util/bounded_queue.hpp"
+#include "../util/index_writer.hpp"
+
+// Settings of a pipelined build.
+struct PipelineOptions {
+    int workers = 1;          // builder threads
+    int batch_docs = 64;      // documents per batch
+    int queue_batches = 0;    // capacity of each queue and of the reorder window; 0 = 2 per worker
+    int doc_limit = 0;        // documents to read; 0 = all
+    long long held_cw_bytes = 0;   // CW bytes of finished batches not yet appended; 0 = unbounded
+};
+
+// Time a stage spent working and blocked on its queues, in seconds. For the
+// workers these are sums over the threads.
+struct StageUsage {
+    double busy = 0;
+    double starved = 0;   // waiting for input
+    double blocked = 0;   // waiting for room downstream
+};
+
+// Build in three overlapping stages joined by bounded queues: a reader
+// streaming batches of documents from the corpus file, workers each running
+// their own builder over a batch (document ids local to it), and a writer
+// that takes finished batches back in corpus order, shifts their document
+// ids and appends the CWs to an IndexWriter. A worker starts a batch only
+// within queue_batches of the next one the writer needs, so one slow batch
+// cannot make the writer hold an unbounded backlog of later ones; under
+// held_cw_bytes, a finished batch also waits until its CWs fit beside those
+// already waiting to be appended. Only the
+// batches in flight are held, never the whole corpus, and since each batch is built exactly as
+// buildCW builds it and appended in order, the index is byte-identical to a
+// sequential build's.
+template<typename WeightType, typename TF = DynamicTF>
+class BuildPipeline {
+public:
+    using Builder = AbstractBuilder<WeightType, TF>;
+    // Creates a configured builder over the given (refilled per batch) docs.
+    using Factory = std::function<std::unique_ptr<Builder>(const std::vector<std::vector<int>> &)>;
+
+private:
+    struct DocBatch {
+        long long seq = 0;
+        int first_doc = 0;
+        std::vector<std::vector<int>> docs;
+    };
+
+    struct CWBatch {
+        long long seq = 0;
+        int first_doc = 0;
+        std::vector<std::vector<int>> docs;   // for the per-document stats
+        std::vector<std::vector<CW<WeightType>>> cws;
+        long long cw_bytes = 0;   // capacity of cws
+        BuildStats stats;
+    };
+
+    Factory factory;
+    PipelineOptions opts;
+    // Workers' docs vectors, which their builders reference, and builders
+    std::vector<std::unique_ptr<std::vector<std::vector<int>>>> worker_docs;
+    std::vector<std::unique_ptr<Builder>> builders;
+    const VocabMap *vocab = nullptr;
+    int token_num = 0;
+    StageUsage reader, workers, writer;
+    double wall = 0;
+    long long batches = 0;
+
+    // Read the next batch; false at the end of the corpus or the limit.
+    bool readBatch(std::ifstream &in, const std::string &src_file, int &next_doc, DocBatch &batch) {
+        batch.docs.clear();
+        batch.first_doc = next_doc;
+        int size;
+        while ((int)batch.docs.size() < opts.batch_docs && (opts.doc_limit == 0 || next_doc < opts.doc_limit) &&
+               in.read(reinterpret_cast<char*>(&size), sizeof(size))) {
+            if (size < 0) {
+                throw std::runtime_error("Corrupt document length at document " + std::to_string(next_doc) + ": " +
+                                         src_file);
+            }
+            std::vector<int> doc(size);
+            if (!in.read(reinterpret_cast<char*>(doc.data()), sizeof(int) * (size_t)size)) {
+                throw std::runtime_error("Corpus file truncated at document " + std::to_string(next_doc) + ": " +
+                                         src_file);
+            }
+            if (vocab) {
+                vocab->remap(doc.data(), size, next_doc);
+            } else {
+                checkTokens(doc.data(), size, token_num, next_doc);
+            }
+            batch.docs.push_back(std::move(doc));
+            next_doc++;
+        }
+        return !batch.docs.empty();
+    }
+
+public:
+    BuildPipeline(Factory factory_, const PipelineOptions &opts_) : factory(std::move(factory_)), opts(opts_) {
+        opts.workers = std::max(1, opts.workers);
+        opts.batch_docs = std::max(1, opts.batch_docs);
+        if (opts.queue_batches <= 0) opts.queue_batches = 2 * opts.workers;
+        for (int w = 0; w < opts.workers; w++) {
+            worker_docs.push_back(std::make_unique<std::vector<std::vector<int>>>());
+            builders.push_back(factory(*worker_docs.back()));
+        }
+        token_num = builders[0]->getHasher().getTokenNum();
+    }
+
+    // Build over dense ids: the reader remaps each document as it reads it.
+    void setVocabMap(const VocabMap &map) {
+        vocab = &map;
+        for (auto &b : builders) b->setVocabMap(map);
+    }
+
+    // Builder of worker 0, for its hasher configuration and description.
+    const Builder &builder() const { return *builders[0]; }
+
+    // Build the index of src_file into out, folding build counters into stats.
+    void run(const std::string &src_file, IndexWriter<WeightType> &out, BuildStats &stats) {
+        std::ifstream in(src_file, std::ios::binary);
+        if (!in.is_open()) {
+            throw std::runtime_error("Cannot open corpus file: " + src_file);
+        }
+        BoundedQueue<DocBatch> doc_q(opts.queue_batches);
+        BoundedQueue<CWBatch> cw_q(opts.queue_batches);
+        std::atomic<bool> failed{false};
+        std::atomic<int> running{opts.workers};
+        std::exception_ptr reader_error;
+        std::vector<std::exception_ptr> worker_errors(opts.workers);
+        std::vector<double> worker_busy(opts.workers, 0);
+        std::vector<double> worker_held(opts.workers, 0);
+        // Reorder window: batches seq < next_seq + queue_batches may be built,
+        // and their CWs, held_bytes in all, wait for the writer.
+        std::mutex order_mu;
+        std::condition_variable order_cv;
+        long long next_seq = 0;
+        long long held_bytes = 0;
+        auto fail = [&]() {
+            std::lock_guard<std::mutex> lock(order_mu);
+            failed = true;
+            order_cv.notify_all();
+        };
+        auto wall_st = timerStart();
+
+        std::thread read_thread([&]() {
+            try {
+                int next_doc = 0;
+                for (long long seq = 0; !failed; seq++) {
+                    DocBatch batch;
+                    auto st = timerStart();
+                    bool more = readBatch(in, src_file, next_doc, batch);
+                    reader.busy += timerCheck(st);
+                    if (!more) break;
+                    batch.seq = seq;
+                    doc_q.push(std::move(batch));
+                }
+            } catch (...) {
+                reader_error = std::current_exception();
+                fail();
+            }
+            doc_q.close();
+        });
+
+        std::vector<std::thread> work_threads;
+        for (int w = 0; w < opts.workers; w++) {
+            work_threads.emplace_back([&, w]() {
+                try {
+                    std::vector<std::vector<int>> &docs = *worker_docs[w];
+                    Builder &b = *builders[w];
+                    DocBatch batch;
+                    while (!failed && doc_q.pop(batch)) {
+                        {
+                            std::unique_lock<std::mutex> lock(order_mu);
+                            if (batch.seq >= next_seq + opts.queue_batches && !failed) {
+                                auto st = timerStart();
+                                order_cv.wait(lock, [&] { return batch.seq < next_seq + opts.queue_batches || failed; });
+                                worker_held[w] += timerCheck(st);
+                            }
+                        }
+                        if (failed) break;
+                        auto st = timerStart();
+                        docs = std::move(batch.docs);
+                        b.buildCW();
+                        CWBatch done;
+                        done.seq = batch.seq;
+                        done.first_doc = batch.first_doc;
+                        done.cws = b.takeCWs();
+                        for (auto &list : done.cws) {
+                            for (auto &cw : list) cw.T += batch.first_doc;
+                        }
+                        for (const auto &list : done.cws) done.cw_bytes += vectorBytes(list);
+                        done.stats = b.getStats();
+                        done.docs = std::move(docs);
+                        docs.clear();
+                        worker_busy[w] += timerCheck(st);
+                        {
+                            // The batch the writer needs next always passes.
+                            std::unique_lock<std::mutex> lock(order_mu);
+                            auto fits = [&] {
+                                return opts.held_cw_bytes <= 0 || done.seq == next_seq ||
+                                       held_bytes + done.cw_bytes <= opts.held_cw_bytes || failed;
+                            };
+                            if (!fits()) {
+                                auto wait_st = timerStart();
+                                order_cv.wait(lock, fits);
+                                worker_held[w] += timerCheck(wait_st);
+                            }
+                            held_bytes += done.cw_bytes;
+                        }
+                        cw_q.push(std::move(done));
+                    }
+                } catch (...) {
+                    worker_errors[w] = std::current_exception();
+                    fail();
+                    doc_q.close();
+                }
+                if (--running == 0) cw_q.close();
+            });
+        }
+
+        // Writer: this thread, appending batches back in corpus order and
+        // moving the reorder window past them. If appending fails (a spill
+        // under a memory budget), the other stages are stopped and drained
+        // before the error leaves run.
+        std::map<long long, CWBatch> pending;
+        long long appended = 0;
+        std::exception_ptr writer_error;
+        CWBatch done;
+        try {
+            while (cw_q.pop(done)) {
+                auto st = timerStart();
+                long long seq = done.seq;
+                pending.emplace(seq, std::move(done));
+                long long released = 0;
+                for (auto it = pending.find(appended); it != pending.end(); it = pending.find(++appended)) {
+                    if (!failed) {
+                        out.append(it->second.cws, (int)it->second.docs.size());
+                        stats.merge(it->second.stats, it->second.first_doc, it->second.docs);
+                    }
+                    released += it->second.cw_bytes;
+                    pending.erase(it);
+                }
+                {
+                    std::lock_guard<std::mutex> lock(order_mu);
+                    next_seq = appended;
+                    held_bytes -= released;
+                }
+                order_cv.notify_all();
+                writer.busy += timerCheck(st);
+            }
+        } catch (...) {
+            writer_error = std::current_exception();
+            fail();
+            doc_q.close();
+            cw_q.close();
+            while (cw_q.pop(done)) {
+            }
+        }
+
+        read_thread.join();
+        for (auto &t : work_threads) t.join();
+        wall = timerCheck(wall_st);
+        batches = appended;
+
+        if (writer_error) std::rethrow_exception(writer_error);
+        if (reader_error) std::rethrow_exception(reader_error);
+        for (auto &e : worker_errors) {
+            if (e) std::rethrow_exception(e);
+        }
+
+        for (double b : worker_busy) workers.busy += b;
+        reader.blocked = doc_q.pushWaitSeconds();
+        workers.starved = doc_q.popWaitSeconds();
+        workers.blocked = cw_q.pushWaitSeconds();
+        for (double h : worker_held) workers.blocked += h;
+        writer.starved = cw_q.popWaitSeconds();
+    }
+
+    double wallSeconds() const { return wall; }
+    const StageUsage &readerUsage() const { return reader; }
+    const StageUsage &workerUsage() const { return workers; }
+    const StageUsage &writerUsage() const { return writer; }
+
+    // Busy time of each stage as a share of the wall time (of wall time
+    // times the worker count for the workers), and the busiest stage.
+    void printUtilization(std::ostream &os) const {
+        double w = std::max(wall, 1e-9);
+        auto pct = [&](double busy, int n) { return 100.0 * busy / (w * n); };
+        double r = pct(reader.busy, 1), b = pct(workers.busy, opts.workers), o = pct(writer.busy, 1);
+        os << "Pipeline: " << opts.workers << " workers, " << batches << " batches of up to " << opts.batch_docs
+           << " documents, queues of " << opts.queue_batches << std::endl;
+        os << std::fixed << std::setprecision(3);
+        os << "  reader : busy " << reader.busy << " s (" << std::setprecision(1) << r << "%)"
+           << std::setprecision(3) << ", blocked on full queue " << reader.blocked << " s" << std::endl;
+        os << "  workers: busy " << workers.busy << " s (" << std::setprecision(1) << b << "%)"
+           << std::setprecision(3) << ", starved " << workers.starved << " s, blocked " << workers.blocked << " s"
+           << std::endl;
+        os << "  writer : busy " << writer.busy << " s (" << std::setprecision(1) << o << "%)"
+           << std::setprecision(3) << ", starved " << writer.starved << " s" << std::endl;
+        os << std::defaultfloat;
+        const char *bottleneck = b >= r && b >= o ? "workers" : (r >= o ? "reader" : "writer");
+        os << "  bottleneck: " << bottleneck << std::endl;
+    }
+
+    // Scratch of the workers' builders (their corpus and CW vectors are
+    // empty between batches).
+    long long workerScratchBytes() const {
+        long long sum = 0;
+        for (const auto &b : builders) {
+            MemoryReport r;
+            b->reportMemory(r);
+            sum += r.totalReserved();
+        }
+        return sum;
+    }
+};
@@ -8,6 +8,7 @@
 #include "../util/cw.hpp"
 #include "../util/hasher.hpp"
 #include "../util/splay.hpp"
+#include "../util/rank_hash.hpp"
 #include "AbstractBuilder.hpp"
 
 enum class SearchStrategy {
@@ -15,20 +16,25 @@ enum class SearchStrategy {
     LINEAR_SCAN
 };
 
-template<typename WeightType>
-class MonotonicBuilder : public AbstractBuilder<WeightType>
+template<typename WeightType, typename TF = DynamicTF>
+class MonotonicBuilder : public AbstractBuilder<WeightType, TF>
 {
-    using Base = AbstractBuilder<WeightType>;
+    using Base = AbstractBuilder<WeightType, TF>;
     using Base::k;
     using Base::tokenNum;
     using Base::docs;
     using Base::cws;
     using Base::hasher;
-    using Base::calculateTF;
+    using Base::prepareWeights;
+    using Base::stats;
+    using Base::recordStep;
 
-private:
+protected:
     std::vector<int> first, freq;
     std::vector<WeightType> mini;
+    DocWeights<WeightType> weights;
+    RankHashTable<WeightType> ranks;
+    std::vector<WeightType> key_values;   // hash of keys[i], filled with the keys
     bool active;
     SearchStrategy strategy;
 
@@ -64,108 +70,126 @@ private:
         return ret;
     }
 
+    // Weights and rank rows of doc, shared by the k hash functions; run once
+    // per document before generating its keys.
+    void prepareDoc(const std::vector<int> &doc)
+    {
+        // Key generation leaves freq holding the previous document's counts
+        for (int t : doc)
+        {
+            freq[t] = 0;
+        }
+        prepareWeights(doc, weights, freq);
+        ranks.index(doc, freq);
+    }
+
+    // Sort keys by hash value and keep the values in key_values. The sort
+    // sees the same sequence and comparisons as sorting the bare keys, so
+    // the order (including ties) is the same.
+    template<typename Less>
+    void sortKeys(std::vector<pair<int, int>> &keys, Less less)
+    {
+        std::vector<std::pair<WeightType, pair<int, int>>> valued;
+        valued.reserve(keys.size());
+        for (const auto &tx : keys)
+        {
+            valued.emplace_back(ranks.value(tx.first, tx.second), tx);
+        }
+        std::sort(valued.begin(), valued.end(), less);
+        key_values.resize(keys.size());
+        for (size_t i = 0; i < valued.size(); i++)
+        {
+            key_values[i] = valued[i].first;
+            keys[i] = valued[i].second;
+        }
+    }
+
+    // Every occurrence is a key. Leaves freq holding the token counts of doc.
     void generateKeys(const int hid, const std::vector<int> &doc, std::vector<pair<int, int>> &keys)
     {
         int n = doc.size();
+        ranks.evaluate(hasher, hid, doc, weights);
         for (int i = 0; i < n; i++)
         {
             freq[doc[i]] = 0;
         }
-        int max_freq = 0;
-        for (int i = 0; i < n; i++) {
-            freq[doc[i]]++;
-            max_freq = max(max_freq, freq[doc[i]]);
-        }
-        for (int i = 0; i < n; i++) {
-            freq[doc[i]] = 0;
-        }
         for (int i = 0; i < n; i++)
         {
             int token = doc[i];
             int x = ++freq[token];
-            WeightType tf = calculateTF(x, max_freq);
-            (void)tf;
             keys.emplace_back(token, x);
         }
-        std::sort(keys.begin(), keys.end(),
-                  [&](const std::pair<int, int> &lhs,
-                      const std::pair<int, int> &rhs)
-                  {
-                      WeightType lhs_tf = calculateTF(lhs.second, max_freq);
-                      WeightType rhs_tf = calculateTF(rhs.second, max_freq);
-                      auto lhsVal = hasher.eval(hid, lhs.first, lhs_tf);
-                      auto rhsVal = hasher.eval(hid, rhs.first, rhs_tf);
-                      if (lhsVal == rhsVal) return lhs.second < rhs.second;
-                      return lhsVal < rhsVal;
-                  });
+        sortKeys(keys, [](const std::pair<WeightType, pair<int, int>> &lhs,
+                          const std::pair<WeightType, pair<int, int>> &rhs)
+                 {
+                     if (lhs.first == rhs.first) return lhs.second.second < rhs.second.second;
+                     return lhs.first < rhs.first;
+                 });
     }
 
+    // Only occurrences that lower their token's running minimum are keys.
+    // Leaves freq holding the token counts of doc.
     void generateActiveKeys(const int hid, const std::vector<int> &doc, std::vector<pair<int, int>> &keys)
     {
         int n = doc.size();
+        ranks.evaluate(hasher, hid, doc, weights);
         for (int i = 0; i < n; i++)
         {
             freq[doc[i]] = 0;
         }
-        int max_freq = 0;
-        for (int i = 0; i < n; i++) {
-            freq[doc[i]]++;
-            max_freq = max(max_freq, freq[doc[i]]);
-        }
-        for (int i = 0; i < n; i++) {
-            freq[doc[i]] = 0;
-        }
-        
         for (int i = 0; i < n; i++)
         {
             int token = doc[i];
             int x = ++freq[token];
-            WeightType tf = calculateTF(x, max_freq);
-            auto v = hasher.eval(hid, token, tf);
+            auto v = ranks.value(token, x);
             if (x == 1 || v < mini[token])
             {
                 mini[token] = v;
                 keys.emplace_back(token, x);
             }
         }
-        std::sort(keys.begin(), keys.end(),
-                  [&](const std::pair<int, int> &lhs,
-                      const std::pair<int, int> &rhs)
-                  {
-                      WeightType lhs_tf = calculateTF(lhs.second, max_freq);
-                      WeightType rhs_tf = calculateTF(rhs.second, max_freq);
-                      auto lhsVal = hasher.eval(hid, lhs.first, lhs_tf);
-                      auto rhsVal = hasher.eval(hid, rhs.first, rhs_tf);
-                      return lhsVal < rhsVal;
-                  });
+        sortKeys(keys, [](const std::pair<WeightType, pair<int, int>> &lhs,
+                          const std::pair<WeightType, pair<int, int>> &rhs)
+                 {
+                     return lhs.first < rhs.first;
+                 });
     }
 
     void buildCWBinarySearch()
     {
-        for (int hid = 0; hid < k; hid++)
+        std::vector<int> next;
+        std::vector<std::pair<int, int>> keys;
+        for (int doc_id = 0; doc_id < (int)docs.size(); doc_id++)
         {
-            for (int doc_id = 0; doc_id < (int)docs.size(); doc_id++)
+            const std::vector<int> &doc = docs[doc_id];
+            int n = (int)doc.size();
+
+            auto prep_st = timerStart();
+            next.resize(n + 1);
+            for (int i = 0; i < n; i++)
             {
-                const std::vector<int> &doc = docs[doc_id];
-                int n = (int)doc.size();
+                first[doc[i]] = n;
+            }
+            next[n] = n;
+            for (int i = n - 1; i >= 0; i--)
+            {
+                next[i] = first[doc[i]];
+                first[doc[i]] = i;
+            }
+            prepareDoc(doc);
+            double prep = timerCheck(prep_st) / k;
+
+            for (int hid = 0; hid < k; hid++)
+            {
+                BuildCounters ctr;
+                auto step_st = timerStart();
+                size_t emitted = cws[hid].size();
 
-                std::vector<int> next(n + 1);
-                std::vector<std::pair<int, int>> keys;
                 SplayTree S;
                 S.insert(-1, -1);
                 S.insert(n, n);
 
-                for (int i = 0; i < n; i++)
-                {
-                    first[doc[i]] = n;
-                }
-                next[n] = n;
-                for (int i = n - 1; i >= 0; i--)
-                {
-                    next[i] = first[doc[i]];
-                    first[doc[i]] = i;
-                }
-
+                keys.clear();
                 keys.reserve(n);
                 if (active)
                 {
@@ -175,22 +199,14 @@ private:
                 {
                     generateKeys(hid, doc, keys);
                 }
+                ctr.keys = keys.size();
+                ctr.keys_skipped = n - (long long)keys.size();
 
-                int max_freq = 0;
-                for (int i = 0; i < n; i++) {
-                    freq[doc[i]] = 0;
-                }
-                for (int i = 0; i < n; i++) {
-                    freq[doc[i]]++;
-                    max_freq = max(max_freq, freq[doc[i]]);
-                }
-
-                for (auto &tx : keys)
+                for (size_t ki = 0; ki < keys.size(); ki++)
                 {
-                    int t = tx.first;
-                    int x = tx.second;
-                    WeightType tf = calculateTF(x, max_freq);
-                    auto v = hasher.eval(hid, t, tf);
+                    int t = keys[ki].first;
+                    int x = keys[ki].second;
+                    auto v = key_values[ki];
 
                     int keys_start, keys_end;
                     for (int j = 0; j < freq[t] - x + 1; j++)
@@ -211,6 +227,7 @@ private:
                         }
 
                         auto ret = searchInSetBinary(S, std::make_pair(keys_start, keys_end));
+                        ctr.searches++;
 
                         if (ret.second >= ret.first)
                         {
@@ -230,6 +247,7 @@ private:
                             if (iter->first <= keys_start && iter->second >= keys_end)
                             {
                                 S.remove(iter->first);
+                                ctr.removals++;
                             }
                             cws[hid].emplace_back(doc_id, v, a, b, c, d);
                             c = std::next(iter, 1)->second;
@@ -237,40 +255,53 @@ private:
                         if ((dominated.rbegin())->first <= keys_start && (dominated.rbegin())->second >= keys_end)
                         {
                             S.remove((dominated.rbegin())->first);
+                            ctr.removals++;
                         }
                         S.insert(keys_start, keys_end);
                     }
                 }
+                ctr.cws = cws[hid].size() - emitted;
+                ctr.seconds = timerCheck(step_st) + prep;
+                recordStep(hid, doc_id, ctr);
             }
         }
     }
 
     void buildCWLinearScan()
     {
-        for (int hid = 0; hid < k; hid++)
+        std::vector<int> next;
+        std::vector<std::pair<int, int>> keys;
+        for (int doc_id = 0; doc_id < (int)docs.size(); doc_id++)
         {
-            for (int doc_id = 0; doc_id < (int)docs.size(); doc_id++)
+            const std::vector<int> &doc = docs[doc_id];
+            int n = (int)doc.size();
+
+            auto prep_st = timerStart();
+            next.resize(n + 1);
+            for (int i = 0; i < n; i++)
+            {
+                first[doc[i]] = n;
+            }
+            next[n] = n;
+            for (int i = n - 1; i >= 0; i--)
+            {
+                next[i] = first[doc[i]];
+                first[doc[i]] = i;
+            }
+            prepareDoc(doc);
+            double prep = timerCheck(prep_st) / k;
+
+            for (int hid = 0; hid < k; hid++)
             {
-                const std::vector<int> &doc = docs[doc_id];
-                int n = (int)doc.size();
+                BuildCounters ctr;
+                auto step_st = timerStart();
+                size_t emitted = cws[hid].size();
 
-                std::vector<int> next(n + 1);
-                std::vector<std::pair<int, int>> keys;
                 std::set<std::pair<int, int>> S;
                 S.insert(std::make_pair(-1, -1));
                 S.insert(std::make_pair(n, n));
 
-                for (int i = 0; i < n; i++)
-                {
-                    first[doc[i]] = n;
-                }
-                next[n] = n;
-                for (int i = n - 1; i >= 0; i--)
-                {
-                    next[i] = first[doc[i]];
-                    first[doc[i]] = i;
-                }
-
+                keys.clear();
                 keys.reserve(n);
                 if (active)
                 {
@@ -280,22 +311,14 @@ private:
                 {
                     generateKeys(hid, doc, keys);
                 }
+                ctr.keys = keys.size();
+                ctr.keys_skipped = n - (long long)keys.size();
 
-                int max_freq = 0;
-                for (int i = 0; i < n; i++) {
-                    freq[doc[i]] = 0;
-                }
-                for (int i = 0; i < n; i++) {
-                    freq[doc[i]]++;
-                    max_freq = max(max_freq, freq[doc[i]]);
-                }
-
-                for (auto &tx : keys)
+                for (size_t ki = 0; ki < keys.size(); ki++)
                 {
-                    int t = tx.first;
-                    int x = tx.second;
-                    WeightType tf = calculateTF(x, max_freq);
-                    auto v = hasher.eval(hid, t, tf);
+                    int t = keys[ki].first;
+                    int x = keys[ki].second;
+                    auto v = key_values[ki];
 
                     int keys_start, keys_end;
                     for (int j = 0; j < freq[t] - x + 1; j++)
@@ -316,6 +339,7 @@ private:
                         }
 
                         auto ret = searchInSetLinear(S, std::make_pair(keys_start, keys_end));
+                        ctr.searches++;
 
                         if ((*(ret.second)).first >= (*(ret.first)).first)
                         {
@@ -334,6 +358,7 @@ private:
                             if (iter->first <= keys_start && iter->second >= keys_end)
                             {
                                 iter = S.erase(iter);
+                                ctr.removals++;
                             }
                             else
                             {
@@ -346,10 +371,14 @@ private:
                         if ((ret.first)->first <= keys_start && (ret.first)->second >= keys_end)
                         {
                             S.erase(ret.first);
+                            ctr.removals++;
                         }
                         S.insert(std::make_pair(keys_start, keys_end));
                     }
                 }
+                ctr.cws = cws[hid].size() - emitted;
+                ctr.seconds = timerCheck(step_st) + prep;
+                recordStep(hid, doc_id, ctr);
             }
         }
     }
@@ -364,13 +393,26 @@ public:
           first(tokenNum_),
           freq(tokenNum_),
           mini(tokenNum_),
+          weights(tokenNum_),
+          ranks(tokenNum_),
           active(active_),
           strategy(strategy_)
     {
     }
 
+    // Per-document arrays (next, keys, the staircase) are local to the build
+    // loops and only show up in peak RSS.
+    void reportMemory(MemoryReport &report) const override
+    {
+        Base::reportMemory(report);
+        report.add("scratch", vectorBytes(first) + vectorBytes(freq) + vectorBytes(mini) + vectorBytes(key_values));
+        report.add("doc_weights", weights.memoryBytes());
+        report.add("rank_hashes", ranks.memoryBytes());
+    }
+
     void buildCW() override
     {
+        stats.reset(k, docs.size());
         if (strategy == SearchStrategy::BINARY_SEARCH)
         {
             buildCWBinarySearch();
@@ -1,71 +1,150 @@
 #pragma once
 
 #include "AbstractBuilder.hpp"
+#include "../util/rank_hash.hpp"
+#include "../util/simd.hpp"
 
-template<typename WeightType>
-class SingleColumnBuilder : public AbstractBuilder<WeightType>
+template<typename WeightType, typename TF = DynamicTF>
+class SingleColumnBuilder : public AbstractBuilder<WeightType, TF>
 {
-    using Base = AbstractBuilder<WeightType>;
+    using Base = AbstractBuilder<WeightType, TF>;
     using Base::k;
     using Base::tokenNum;
     using Base::docs;
     using Base::cws;
     using Base::hasher;
-    using Base::calculateTF;
+    using Base::prepareWeights;
+    using Base::stats;
+    using Base::recordStep;
 private:
     std::vector<int> freq;
+    DocWeights<WeightType> weights;
+    RankHashTable<WeightType> ranks;
+    std::vector<WeightType> w;
+    bool fast;
+
+    // Same CWs as the scan in buildCW, from hashes evaluated once per
+    // occurrence. w[j] is the hash of position j for windows starting at the
+    // current start i; advancing i only changes the later occurrences of
+    // doc[i], so the array is shared across starts and each prefix minimum
+    // is found with a vector compare over it.
+    void buildDocFast(int hid, int doc_id, const std::vector<int> &doc)
+    {
+        int n = (int)doc.size();
+        ranks.evaluate(hasher, hid, doc, weights);
+        w.resize(n);
+        for (int j = 0; j < n; j++)
+        {
+            w[j] = ranks.value(doc[j], ranks.occurrence(j) + 1);
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            int c = i;
+            WeightType v = w[i];
+            for (int d = findFirstLess(w.data(), i + 1, n, v); d < n; d = findFirstLess(w.data(), d + 1, n, v))
+            {
+                cws[hid].emplace_back(doc_id, v, i, i, c, d - 1);
+                c = d;
+                v = w[d];
+            }
+            cws[hid].emplace_back(doc_id, v, i, i, c, n - 1);
+
+            // Dropping position i lowers the count of every later occurrence of doc[i] by one
+            int t = doc[i], row = ranks.rowOf(t), idx = ranks.occurrence(i);
+            const WeightType *h = ranks.row(t);
+            for (int m = idx + 1; m < ranks.count(t); m++)
+            {
+                w[ranks.position(row + m)] = h[m - idx - 1];
+            }
+        }
+    }
+
+    // Scan every start i of doc and emit a CW per new prefix minimum. The
+    // document's weights (and rank rows) are prepared by buildCW.
+    void buildDoc(int hid, int doc_id, const std::vector<int> &doc)
+    {
+        int n = (int)doc.size();
+        if (fast)
+        {
+            buildDocFast(hid, doc_id, doc);
+            return;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            for (int j = i; j < n; j++)
+            {
+                freq[doc[j]] = 0;
+            }
+            int c = i;
+            auto v = hasher.evalWeighted(hid, doc[i], weights.weight(doc[i], 1));
+            ++freq[doc[i]];
+            for (int d = i; d < n - 1; d++)
+            {
+                int t = doc[d + 1];
+                auto h = hasher.evalWeighted(hid, t, weights.weight(t, ++freq[t]));
+                if (h < v)
+                {
+                    cws[hid].emplace_back(doc_id, v, i, i, c, d);
+                    c = d + 1;
+                    v = h;
+                }
+            }
+            cws[hid].emplace_back(doc_id, v, i, i, c, n - 1);
+        }
+        for (int i = 0; i < n; i++)
+        {
+            freq[doc[i]] = 0;
+        }
+    }
 
 public:
     SingleColumnBuilder(const std::vector<std::vector<int>> &docs_,
                        int k_,
-                       int tokenNum_)
+                       int tokenNum_,
+                       bool fast_ = false)
         : Base(docs_, k_, tokenNum_),
-          freq(tokenNum_)
+          freq(tokenNum_),
+          weights(tokenNum_),
+          ranks(tokenNum_),
+          fast(fast_)
     {
     }
 
+    void reportMemory(MemoryReport &report) const override
+    {
+        Base::reportMemory(report);
+        report.add("scratch", vectorBytes(freq) + vectorBytes(w));
+        report.add("doc_weights", weights.memoryBytes());
+        report.add("rank_hashes", ranks.memoryBytes());
+    }
+
+    // Documents outer, hash functions inner: weights and rank rows are
+    // prepared once per document, and each cws[hid] still lists documents in
+    // order. The preparation time is split evenly over the k steps.
     void buildCW() override
     {
-        for (int hid = 0; hid < k; hid++)
+        stats.reset(k, docs.size());
+        for (int doc_id = 0; doc_id < (int)docs.size(); doc_id++)
         {
-            for (int doc_id = 0; doc_id < (int)docs.size(); doc_id++)
+            const std::vector<int> &doc = docs[doc_id];
+            auto prep_st = timerStart();
+            prepareWeights(doc, weights, freq);
+            if (fast)
             {
-                const std::vector<int> &doc = docs[doc_id];
-                int n = (int)doc.size();
-                // Calculate max frequency first
-                int max_freq = 0;
-                for (int i = 0; i < n; i++) {
-                    freq[doc[i]] = 0;
-                }
-                for (int i = 0; i < n; i++) {
-                    freq[doc[i]]++;
-                    max_freq = max(max_freq, freq[doc[i]]);
-                }
-                
-                for (int i = 0; i < n; i++)
-                {
-                    for (int j = i; j < n; j++)
-                    {
-                        freq[doc[j]] = 0;
-                    }
-                    int c = i;
-                    WeightType tf = calculateTF(1, max_freq);
-                    auto v = hasher.eval(hid, doc[i], tf);
-                    ++freq[doc[i]];
-                    for (int d = i; d < n - 1; d++)
-                    {
-                        ++freq[doc[d + 1]];
-                        WeightType new_tf = calculateTF(freq[doc[d + 1]], max_freq);
-                        if (hasher.eval(hid, doc[d + 1], new_tf) < v)
-                        {
-                            cws[hid].emplace_back(doc_id, v, i, i, c, d);
-                            c = d + 1;
-                            v = hasher.eval(hid, doc[d + 1], new_tf);
-                        }
-                    }
-                    cws[hid].emplace_back(doc_id, v, i, i, c, n - 1);
-                }
+                ranks.index(doc, freq);
+            }
+            double prep = timerCheck(prep_st) / k;
+            for (int hid = 0; hid < k; hid++)
+            {
+                BuildCounters ctr;
+                auto step_st = timerStart();
+                size_t emitted = cws[hid].size();
+                buildDoc(hid, doc_id, doc);
+                ctr.cws = cws[hid].size() - emitted;
+                ctr.seconds = timerCheck(step_st) + prep;
+                recordStep(hid, doc_id, ctr);
             }
         }
     }
-};
\ No newline at end of file
+};
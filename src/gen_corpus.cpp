@@ -0,0 +1,272 @@
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <unordered_map>
+#include <algorithm>
+#include <stdexcept>
+#include <unistd.h>
+#include "./util/util.hpp"
+#include "./util/synth.hpp"
+
+using namespace std;
+
+// One planted near-duplicate: a mutated copy of src_doc[src_start, src_start + len)
+// written over dst_doc[dst_start, dst_start + len).
+struct Plant {
+    int id;
+    int src_doc, src_start;
+    int dst_doc, dst_start;
+    int len;
+    double jaccard;
+};
+
+bool overlaps(const vector<pair<int, int>> &used, int start, int len) {
+    for (auto &iv : used) {
+        if (start < iv.second && iv.first < start + len) return true;
+    }
+    return false;
+}
+
+// Replace random positions of copy (initially equal to src) with corpus tokens
+// until the weighted Jaccard similarity under raw TF, sum(min) / sum(max) of
+// the token counts, drops to target. Returns the similarity reached.
+double mutateTo(vector<int> &copy, const vector<int> &src, double target,
+                SyntheticCorpus &corpus, mt19937_64 &rng) {
+    unordered_map<int, int> A, B;
+    for (int t : src) A[t]++;
+    B = A;
+    long long summin = src.size(), summax = src.size();
+    auto add = [&](int t, int sign) {
+        int a = A.count(t) ? A[t] : 0, b = B[t];
+        summin += sign * min(a, b);
+        summax += sign * max(a, b);
+    };
+
+    vector<int> order(copy.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    shuffle(order.begin(), order.end(), rng);
+    for (size_t idx = 0; idx < order.size() && (double)summin / summax > target; idx++) {
+        int p = order[idx];
+        int old_t = copy[p], new_t = corpus.randomToken(rng);
+        if (new_t == old_t) continue;
+        add(old_t, -1);
+        add(new_t, -1);
+        B[old_t]--;
+        B[new_t]++;
+        add(old_t, 1);
+        add(new_t, 1);
+        copy[p] = new_t;
+    }
+    return (double)summin / summax;
+}
+
+int main(int argc, char *argv[]) {
+    SynthConfig cfg;
+    string out_file;
+    string truth_file;
+    string query_dir;
+    int doc_num = 1000;
+    int plant_num = 0;
+    int passage_len = 128;
+    double target_jaccard = 0.8;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "o:n:L:D:S:v:z:P:m:J:g:q:s:")) != EOF) {
+        switch (opt) {
+        case 'o':
+            out_file = optarg;
+            break;
+        case 'n':
+            doc_num = stoi(optarg);
+            break;
+        case 'L':
+            cfg.mean_length = stoi(optarg);
+            break;
+        case 'D':
+            try {
+                cfg.length_dist = parseLengthDist(optarg);
+            } catch (const std::exception &e) {
+                std::cerr << "Error: " << e.what() << std::endl;
+                return 1;
+            }
+            break;
+        case 'S':
+            cfg.spread = stod(optarg);
+            break;
+        case 'v':
+            cfg.vocab = stoi(optarg);
+            break;
+        case 'z':
+            cfg.zipf = stod(optarg);
+            break;
+        case 'P':
+            plant_num = stoi(optarg);
+            break;
+        case 'm':
+            passage_len = stoi(optarg);
+            break;
+        case 'J':
+            target_jaccard = stod(optarg);
+            break;
+        case 'g':
+            truth_file = optarg;
+            break;
+        case 'q':
+            query_dir = optarg;
+            break;
+        case 's':
+            cfg.seed = stoull(optarg);
+            break;
+        case '?':
+            std::cout << "Synthetic Corpus Generator - OptAlign" << std::endl;
+            std::cout << "Usage: gencorpus -o <data.bin> [options]" << std::endl;
+            std::cout << std::endl;
+            std::cout << "Required:" << std::endl;
+            std::cout << "  -o <file>     Output binary document file (format read by build -f)" << std::endl;
+            std::cout << std::endl;
+            std::cout << "Optional:" << std::endl;
+            std::cout << "  -n <num>      Number of documents (default: 1000)" << std::endl;
+            std::cout << "  -L <num>      Mean document length in tokens (default: 512)" << std::endl;
+            std::cout << "  -D <dist>     Length distribution: fixed, uniform, normal, lognormal (default)" << std::endl;
+            std::cout << "  -S <num>      Length spread: lognormal sigma, or relative width (default: 0.5)" << std::endl;
+            std::cout << "  -v <num>      Vocabulary size, as build -v (default: 50257)" << std::endl;
+            std::cout << "  -z <num>      Zipf exponent of token frequencies, 0 = uniform (default: 1.0)" << std::endl;
+            std::cout << "  -P <num>      Number of planted near-duplicate passages (default: 0)" << std::endl;
+            std::cout << "  -m <num>      Planted passage length in tokens (default: 128)" << std::endl;
+            std::cout << "  -J <num>      Target weighted Jaccard (raw TF) of planted pairs (default: 0.8)" << std::endl;
+            std::cout << "  -g <file>     Ground-truth TSV of planted pairs (default: <data.bin>.truth.tsv)" << std::endl;
+            std::cout << "  -q <dir>      Also write each planted source passage as <dir>/query_<id>.txt" << std::endl;
+            std::cout << "  -s <num>      Random seed (default: 1)" << std::endl;
+            return 0;
+        }
+    }
+
+    if (out_file.empty()) {
+        std::cerr << "Error: Output file (-o) is required." << std::endl;
+        return 1;
+    }
+    if (doc_num <= 0 || cfg.mean_length <= 0 || passage_len <= 0) {
+        std::cerr << "Error: -n, -L and -m must be positive." << std::endl;
+        return 1;
+    }
+    if (plant_num > 0 && doc_num < 2) {
+        std::cerr << "Error: Planting passages needs at least two documents." << std::endl;
+        return 1;
+    }
+    if (truth_file.empty()) {
+        truth_file = out_file + ".truth.tsv";
+    }
+
+    std::cout << "Parameters Summary: \n";
+    std::cout << "out_file       : " << out_file << "\n";
+    std::cout << "doc_num        : " << doc_num << "\n";
+    std::cout << "mean_length    : " << cfg.mean_length << "\n";
+    std::cout << "vocab          : " << cfg.vocab << "\n";
+    std::cout << "zipf           : " << cfg.zipf << "\n";
+    std::cout << "plants         : " << plant_num << "\n";
+    if (plant_num > 0) {
+        std::cout << "passage_len    : " << passage_len << "\n";
+        std::cout << "target_jaccard : " << target_jaccard << "\n";
+        std::cout << "truth_file     : " << truth_file << "\n";
+    }
+    std::cout << "------------------------------" << std::endl;
+
+    auto gen_st = timerStart();
+    SyntheticCorpus corpus(cfg);
+    vector<int> lengths(doc_num);
+    for (int i = 0; i < doc_num; i++) {
+        lengths[i] = corpus.length(i);
+    }
+
+    // Choose non-overlapping source and target regions up front, so documents
+    // can be generated and written one at a time.
+    vector<Plant> plants;
+    unordered_map<int, vector<pair<int, int>>> used;
+    unordered_map<int, vector<int>> plants_into;
+    mt19937_64 plan_rng(splitmix64(cfg.seed ^ 0x706c616e74ULL));
+    uniform_int_distribution<int> pick_doc(0, doc_num - 1);
+    for (long long attempt = 0; (int)plants.size() < plant_num && attempt < 100LL * plant_num; attempt++) {
+        int s = pick_doc(plan_rng), t = pick_doc(plan_rng);
+        if (s == t || lengths[s] < passage_len || lengths[t] < passage_len) continue;
+        int ss = uniform_int_distribution<int>(0, lengths[s] - passage_len)(plan_rng);
+        int ts = uniform_int_distribution<int>(0, lengths[t] - passage_len)(plan_rng);
+        if (overlaps(used[s], ss, passage_len) || overlaps(used[t], ts, passage_len)) continue;
+        used[s].emplace_back(ss, ss + passage_len);
+        used[t].emplace_back(ts, ts + passage_len);
+        plants_into[t].push_back(plants.size());
+        plants.push_back({(int)plants.size(), s, ss, t, ts, passage_len, 0.0});
+    }
+    if ((int)plants.size() < plant_num) {
+        std::cout << "Warning: only " << plants.size() << " of " << plant_num
+                  << " passages fit without overlapping (documents too short or too few)" << std::endl;
+    }
+
+    ofstream ofs(out_file, ios::binary);
+    if (!ofs.is_open()) {
+        std::cerr << "Error: Cannot open output file: " << out_file << std::endl;
+        return 1;
+    }
+    long long total_tokens = 0;
+    vector<int> doc, src;
+    for (int i = 0; i < doc_num; i++) {
+        corpus.generate(i, doc);
+        auto it = plants_into.find(i);
+        if (it != plants_into.end()) {
+            for (int pid : it->second) {
+                Plant &p = plants[pid];
+                corpus.generate(p.src_doc, src);
+                vector<int> passage(src.begin() + p.src_start, src.begin() + p.src_start + p.len);
+                vector<int> copy = passage;
+                mt19937_64 rng(splitmix64(cfg.seed ^ splitmix64(0x6d757461ULL + pid)));
+                p.jaccard = mutateTo(copy, passage, target_jaccard, corpus, rng);
+                std::copy(copy.begin(), copy.end(), doc.begin() + p.dst_start);
+            }
+        }
+        int size = doc.size();
+        ofs.write((char *)&size, sizeof(int));
+        ofs.write((char *)doc.data(), sizeof(int) * size);
+        total_tokens += size;
+    }
+    ofs.close();
+
+    if (!plants.empty()) {
+        ofstream truth(truth_file);
+        if (!truth.is_open()) {
+            std::cerr << "Error: Cannot open ground-truth file: " << truth_file << std::endl;
+            return 1;
+        }
+        // Ranges are inclusive token positions, as printed by query.
+        truth << "pair_id\tsrc_doc\tsrc_start\tsrc_end\tdst_doc\tdst_start\tdst_end\tjaccard\n";
+        for (auto &p : plants) {
+            truth << p.id << "\t" << p.src_doc << "\t" << p.src_start << "\t" << p.src_start + p.len - 1 << "\t"
+                  << p.dst_doc << "\t" << p.dst_start << "\t" << p.dst_start + p.len - 1 << "\t" << p.jaccard << "\n";
+        }
+    }
+
+    if (!query_dir.empty()) {
+        for (auto &p : plants) {
+            corpus.generate(p.src_doc, src);
+            string path = query_dir + "/query_" + to_string(p.id) + ".txt";
+            ofstream q(path);
+            if (!q.is_open()) {
+                std::cerr << "Error: Cannot open query file: " << path << std::endl;
+                return 1;
+            }
+            for (int j = 0; j < p.len; j++) {
+                q << (j ? " " : "") << src[p.src_start + j];
+            }
+            q << "\n";
+        }
+    }
+
+    double jaccard_sum = 0;
+    for (auto &p : plants) jaccard_sum += p.jaccard;
+    cout << "Generation Time: " << timerCheck(gen_st) << " s" << endl;
+    cout << "Documents: " << doc_num << ", tokens: " << total_tokens << endl;
+    cout << "Planted passages: " << plants.size();
+    if (!plants.empty()) cout << ", mean weighted Jaccard: " << jaccard_sum / plants.size();
+    cout << endl;
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include <string>
+#include <vector>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+#include "./util/util.hpp"
+#include "./util/mapped_corpus.hpp"
+#include "./util/doc_freq.hpp"
+#include "./util/idf_file.hpp"
+#include "./util/memory.hpp"
+
+using namespace std;
+
+// Output format by extension: .tsv and .txt get the token<TAB>idf text
+// format, anything else the binary format.
+bool isTextIDFPath(const std::string &path) {
+    auto ends = [&](const std::string &ext) {
+        return path.size() >= ext.size() && path.compare(path.size() - ext.size(), ext.size(), ext) == 0;
+    };
+    return ends(".tsv") || ends(".txt");
+}
+
+int main(int argc, char *argv[]) {
+    string src_file;
+    string out_file;
+    int doc_num = 0;
+    int tokenNum = 50257;  // Default GPT-2 vocabulary size
+    int threads = (int)std::max(1u, std::thread::hardware_concurrency());
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:o:n:v:p:")) != EOF) {
+        switch (opt) {
+        case 'f':
+            src_file = optarg;
+            break;
+        case 'o':
+            out_file = optarg;
+            break;
+        case 'n':
+            doc_num = stoi(optarg);
+            break;
+        case 'v':
+            tokenNum = stoi(optarg);
+            break;
+        case 'p':
+            threads = stoi(optarg);
+            break;
+        case '?':
+            std::cout << "IDF Table Builder - OptAlign" << std::endl;
+            std::cout << "Usage: idf -f <data.bin> -o <file> [options]" << std::endl;
+            std::cout << std::endl;
+            std::cout << "Required:" << std::endl;
+            std::cout << "  -f <file>     Binary document data file" << std::endl;
+            std::cout << "  -o <file>     Output IDF file for build -I: binary, or token<TAB>idf text" << std::endl;
+            std::cout << "                if the name ends in .tsv or .txt" << std::endl;
+            std::cout << std::endl;
+            std::cout << "Optional:" << std::endl;
+            std::cout << "  -n <num>      Limit number of documents (0=all)" << std::endl;
+            std::cout << "  -v <num>      Vocabulary size, as build -v (default: 50257)" << std::endl;
+            std::cout << "  -p <num>      Counting threads (default: hardware threads)" << std::endl;
+            return 0;
+        }
+    }
+
+    if (src_file.empty() || out_file.empty()) {
+        std::cerr << "Error: Input file (-f) and output file (-o) are required." << std::endl;
+        return 1;
+    }
+    if (tokenNum <= 0 || threads <= 0) {
+        std::cerr << "Error: -v and -p must be positive." << std::endl;
+        return 1;
+    }
+
+    std::cout << "Parameters Summary: \n";
+    std::cout << "bin_file_path  : " << src_file << "\n";
+    std::cout << "out_file       : " << out_file << " (" << (isTextIDFPath(out_file) ? "text" : "binary") << ")\n";
+    std::cout << "doc_num        : " << doc_num << "\n";
+    std::cout << "tokenNum       : " << tokenNum << "\n";
+    std::cout << "threads        : " << threads << "\n";
+    std::cout << "------------------------------" << std::endl;
+
+    try {
+        auto scan_st = timerStart();
+        MappedCorpus corpus(src_file);
+        int num_docs = corpus.locateAll(doc_num);
+        cout << "Scan Time: " << timerCheck(scan_st) << " s (" << num_docs << " documents)" << endl;
+        if (num_docs == 0) {
+            throw std::runtime_error("Corpus has no documents: " + src_file);
+        }
+
+        auto count_st = timerStart();
+        DocFrequencies freq = countDocFrequencies(num_docs, tokenNum, threads,
+                                                  [&](long long i) { return corpus.doc((int)i); });
+        cout << "Count Time: " << timerCheck(count_st) << " s (" << freq.tokens << " tokens)" << endl;
+        long long vocab_seen = 0;
+        for (uint32_t df : freq.df) vocab_seen += df > 0;
+        cout << "Tokens occurring: " << vocab_seen << " of " << tokenNum << endl;
+        if (freq.out_of_range > 0) {
+            cout << "Warning: " << freq.out_of_range << " token occurrences outside [0, " << tokenNum
+                 << ") skipped; check -v" << endl;
+        }
+
+        auto write_st = timerStart();
+        std::vector<double> idf = freq.idf();
+        if (isTextIDFPath(out_file)) {
+            writeIDFText(out_file, idf);
+        } else {
+            writeIDFBinary(out_file, idf, freq.num_docs);
+        }
+        cout << "Write Time: " << timerCheck(write_st) << " s" << endl;
+        cout << "IDF written to: " << out_file << endl;
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    cout << "Peak RSS: " << formatBytes(peakRSSBytes()) << endl;
+    return 0;
+}
@@ -3,74 +3,294 @@
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <csignal>
 #include <unistd.h>
 #include "Query.hpp"
+#include "ShardedQuery.hpp"
+#include "util/mapped_corpus.hpp"
 #include "util/index_utils.hpp"
+#include "util/query_stats.hpp"
+#include "util/result_writer.hpp"
 
 using namespace std;
 
+// Set by SIGUSR1; the batch loop dumps the histograms between queries.
+volatile sig_atomic_t dump_requested = 0;
+
+void onDumpSignal(int) {
+    dump_requested = 1;
+}
+
+void writeStats(const QueryStats &stats, const string &stats_file) {
+    stats.print(std::cerr);
+    if (stats_file.empty()) return;
+    std::ofstream ofs(stats_file);
+    if (!ofs.is_open()) {
+        throw std::runtime_error("Cannot open file for writing: " + stats_file);
+    }
+    stats.writeJson(ofs);
+}
+
+// Command-line settings passed down to runQueries.
+struct QueryOptions {
+    double threshold = 0.8;
+    bool batch = false;
+    string stats_file;
+    int threads = 1;            // index loading
+    int probe_hashes = 0;       // 0 = all
+    bool two_stage = false;
+    double min_similarity = -1; // < 0 = no verification
+    string output_file;         // results as rectangles; empty = ranges on stdout
+};
+
+// Configure verification and output on a loaded engine (Query or
+// ShardedQuery), then run the queries.
+template<typename Engine>
+void runLoaded(Engine &query_engine, const vector<vector<int>> &queries, const QueryOptions &opts) {
+    if (opts.min_similarity >= 0) {
+        query_engine.setVerification(opts.min_similarity);
+    }
+    std::unique_ptr<ResultWriter> writer;
+    if (!opts.output_file.empty()) {
+        writer = std::make_unique<ResultWriter>(opts.output_file, opts.min_similarity >= 0);
+        query_engine.setResultWriter(writer.get());
+        std::cout << "Writing result rectangles to " << opts.output_file << " ("
+                  << (ResultWriter::formatFor(opts.output_file) == ResultWriter::Format::BINARY ? "binary" : "JSONL")
+                  << ")" << std::endl;
+    }
+    MemoryReport memory;
+    query_engine.reportMemory(memory);
+    memory.print(std::cout);
+    std::cout << "================================" << std::endl;
+
+    if (!opts.batch) {
+        QueryTimings t = query_engine.query(queries[0], opts.threshold);
+        if (!opts.stats_file.empty()) {
+            QueryStats stats;
+            stats.add(t);
+            writeStats(stats, opts.stats_file);
+        }
+        return;
+    }
+
+    QueryStats stats;
+    signal(SIGUSR1, onDumpSignal);
+    for (size_t qi = 0; qi < queries.size(); qi++) {
+        if (writer) writer->setQuery(qi);
+        QueryTimings t = query_engine.query(queries[qi], opts.threshold, false);
+        stats.add(t);
+        std::cout << "Query " << qi << ": tokens=" << queries[qi].size()
+                  << " candidates=" << t.candidate_docs << " collided=" << t.collided_cws
+                  << " ranges=" << t.result_ranges;
+        if (writer) std::cout << " rects=" << t.result_rects;
+        std::cout << " time=" << t.total() * 1e3 << " ms" << std::endl;
+        if (dump_requested) {
+            dump_requested = 0;
+            stats.print(std::cerr);
+        }
+    }
+    writeStats(stats, opts.stats_file);
+    std::cout << "Peak RSS: " << formatBytes(peakRSSBytes()) << std::endl;
+}
+
+void printProbing(int probe, int needed) {
+    std::cout << "Probing " << probe << " hash functions" << (needed > probe ? ", confirming with all" : "")
+              << std::endl;
+}
+
+template<typename WeightType, typename TF>
+void runQueries(const string &index_file, const vector<vector<int>> &queries, const QueryOptions &opts,
+                MappedCorpus *corpus) {
+    Query<WeightType, TF> query_engine;
+    auto load_st = timerStart();
+    query_engine.loadIndex(index_file, opts.threads, opts.probe_hashes, opts.two_stage);
+    std::cout << "Load Time: " << timerCheck(load_st) << " s" << std::endl;
+    if (opts.probe_hashes) {
+        printProbing(query_engine.probeHashes(), query_engine.hashesNeeded());
+    }
+    query_engine.setCorpus(corpus);
+    std::cout << "Index loaded successfully. CWs=" << query_engine.getTotalCWCount() << std::endl;
+    std::cout << query_engine.getHasherInfo() << std::endl;
+    runLoaded(query_engine, queries, opts);
+}
+
+template<typename WeightType, typename TF>
+void runShardedQueries(const vector<ShardSpec> &specs, const vector<vector<int>> &queries, const QueryOptions &opts) {
+    ShardedQuery<WeightType, TF> query_engine;
+    auto load_st = timerStart();
+    query_engine.loadShards(specs, opts.threads, opts.probe_hashes, opts.two_stage);
+    std::cout << "Load Time: " << timerCheck(load_st) << " s" << std::endl;
+    for (size_t s = 0; s < query_engine.numShards(); s++) {
+        const ShardSpec &spec = query_engine.shard(s);
+        std::cout << "Shard " << s << ": " << spec.index_file << ", first doc " << spec.first_doc
+                  << ", CWs=" << query_engine.engine(s).getTotalCWCount();
+        if (query_engine.engine(s).numDocs()) std::cout << ", docs=" << query_engine.engine(s).numDocs();
+        if (!spec.corpus_file.empty()) std::cout << ", corpus " << spec.corpus_file;
+        std::cout << std::endl;
+    }
+    if (opts.probe_hashes) {
+        printProbing(query_engine.engine(0).probeHashes(), query_engine.engine(0).hashesNeeded());
+    }
+    std::cout << "Shards loaded successfully. CWs=" << query_engine.getTotalCWCount() << std::endl;
+    std::cout << query_engine.engine(0).getHasherInfo() << std::endl;
+    runLoaded(query_engine, queries, opts);
+}
+
 int main(int argc, char *argv[]) {
     string index_file;
+    string manifest_file;
     string query_file;
-    double threshold = 0.8;
+    string corpus_file;
+    QueryOptions opts;
 
     int opt;
-    while ((opt = getopt(argc, argv, "i:f:t:")) != EOF) {
+    while ((opt = getopt(argc, argv, "i:M:f:t:bj:C:p:k:2e:o:")) != EOF) {
         switch (opt) {
         case 'i':
             index_file = optarg;
             break;
+        case 'M':
+            manifest_file = optarg;
+            break;
         case 'f':
             query_file = optarg;
             break;
         case 't':
-            threshold = stod(optarg);
+            opts.threshold = stod(optarg);
+            break;
+        case 'b':
+            opts.batch = true;
+            break;
+        case 'j':
+            opts.stats_file = optarg;
+            break;
+        case 'C':
+            corpus_file = optarg;
+            break;
+        case 'p':
+            opts.threads = stoi(optarg);
+            break;
+        case 'k':
+            opts.probe_hashes = stoi(optarg);
+            break;
+        case '2':
+            opts.two_stage = true;
+            break;
+        case 'e':
+            opts.min_similarity = stod(optarg);
+            break;
+        case 'o':
+            opts.output_file = optarg;
             break;
         case '?':
             std::cout << "Query Index - OptAlign Query Engine" << std::endl;
-            std::cout << "Usage: query -i <index.data> -f <query.txt> [options]" << std::endl;
+            std::cout << "Usage: query -i <index.data> | -M <shards.txt> -f <query.txt> [options]" << std::endl;
             std::cout << std::endl;
             std::cout << "Required:" << std::endl;
             std::cout << "  -i <file>     Index file (created by build)" << std::endl;
+            std::cout << "  -M <file>     Or a shard manifest: per line \"<index> [<first doc id> [<corpus>]]\";" << std::endl;
+            std::cout << "                all shards are searched in parallel and results merged by" << std::endl;
+            std::cout << "                global document id" << std::endl;
             std::cout << "  -f <file>     Query tokens file (space-separated IDs)" << std::endl;
             std::cout << std::endl;
             std::cout << "Optional:" << std::endl;
             std::cout << "  -t <num>      Matching threshold 0.0-1.0 (default: 0.8)" << std::endl;
+            std::cout << "  -b            Batch mode: each line of the query file is a query; prints one" << std::endl;
+            std::cout << "                summary line per query and latency histograms at the end" << std::endl;
+            std::cout << "                (also on SIGUSR1)" << std::endl;
+            std::cout << "  -j <file>     Write per-phase latency histograms and counts as JSON" << std::endl;
+            std::cout << "  -C <file>     Corpus the index was built from (.bin, memory-mapped); fingerprint" << std::endl;
+            std::cout << "                matches are rechecked against it instead of accepted as equal. Without" << std::endl;
+            std::cout << "                the <file>.offsets that build writes, reaching a document first walks" << std::endl;
+            std::cout << "                the length prefix of every earlier one" << std::endl;
+            std::cout << "  -p <num>      Threads loading the index's per-hash blocks, per shard (default: 1)" << std::endl;
+            std::cout << "  -k <num>      Probe only the first <num> hash functions, the threshold applying to" << std::endl;
+            std::cout << "                them; only their blocks are loaded (default: all)" << std::endl;
+            std::cout << "  -2            With -k: confirm documents that pass with all hash functions" << std::endl;
+            std::cout << "  -e <num>      Verify results with -C: score each by exact weighted Jaccard and keep" << std::endl;
+            std::cout << "                those of at least <num> (0 = keep all, annotated); with -o, a rectangle" << std::endl;
+            std::cout << "                is kept if its longest or, failing that, its shortest window scores" << std::endl;
+            std::cout << "                at least <num>" << std::endl;
+            std::cout << "  -o <file>     Stream results to <file> as merged start x end rectangles with each" << std::endl;
+            std::cout << "                document's longest span: binary if it ends in .bin, else JSONL; an exact," << std::endl;
+            std::cout << "                possibly overlapping cover, so a staircase match keeps one per step" << std::endl;
             std::cout << std::endl;
             std::cout << "Examples:" << std::endl;
             std::cout << "  query -i index.data -f query.txt -t 0.7" << std::endl;
             std::cout << "  query -i index_tfidf.data -f query.txt -t 0.5" << std::endl;
+            std::cout << "  query -i index.data -f queries.txt -b -j latency.json" << std::endl;
+            std::cout << "  query -i index.data -f queries.txt -b -k 16 -2" << std::endl;
+            std::cout << "  query -i index.data -f queries.txt -b -C corpus.bin -e 0.7" << std::endl;
+            std::cout << "  query -i index.data -f queries.txt -b -o results.jsonl" << std::endl;
+            std::cout << "  query -M shards.txt -f queries.txt -b -p 2" << std::endl;
             return 0;
         }
     }
 
-    if (index_file.empty() || query_file.empty()) {
-        std::cerr << "Error: Both index file (-i) and query file (-f) are required." << std::endl;
+    if (index_file.empty() == manifest_file.empty() || query_file.empty()) {
+        std::cerr << "Error: An index file (-i) or shard manifest (-M), and a query file (-f), are required."
+                  << std::endl;
+        return 1;
+    }
+    if (!manifest_file.empty() && !corpus_file.empty()) {
+        std::cerr << "Error: With -M, list each shard's corpus in the manifest instead of -C." << std::endl;
+        return 1;
+    }
+    if (opts.min_similarity >= 0 && corpus_file.empty() && manifest_file.empty()) {
+        std::cerr << "Error: Verification (-e) needs the corpus (-C)." << std::endl;
         return 1;
     }
 
-    // Read query tokens from file
-    std::vector<int> query_tokens;
+    // Read query tokens from file: the whole file is one query, or one query
+    // per non-empty line in batch mode.
+    std::vector<std::vector<int>> queries;
     std::ifstream file(query_file);
     if (!file.is_open()) {
         std::cerr << "Error: Cannot open query file: " << query_file << std::endl;
         return 1;
     }
     
-    int token;
-    while (file >> token) {
-        query_tokens.push_back(token);
+    if (opts.batch) {
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream iss(line);
+            std::vector<int> tokens;
+            int token;
+            while (iss >> token) {
+                tokens.push_back(token);
+            }
+            if (!tokens.empty()) {
+                queries.push_back(std::move(tokens));
+            }
+        }
+    } else {
+        std::vector<int> tokens;
+        int token;
+        while (file >> token) {
+            tokens.push_back(token);
+        }
+        if (!tokens.empty()) {
+            queries.push_back(std::move(tokens));
+        }
     }
     file.close();
 
-    if (query_tokens.empty()) {
+    if (queries.empty()) {
         std::cerr << "Error: Query file is empty or contains no valid tokens." << std::endl;
         return 1;
     }
+    const std::vector<int> &query_tokens = queries[0];
 
     std::cout << "Query parameters:" << std::endl;
-    std::cout << "Index file: " << index_file << std::endl;
+    if (manifest_file.empty()) {
+        std::cout << "Index file: " << index_file << std::endl;
+    } else {
+        std::cout << "Shard manifest: " << manifest_file << std::endl;
+    }
     std::cout << "Query file: " << query_file << std::endl;
+    if (opts.batch) {
+        std::cout << "Queries: " << queries.size() << " (batch)" << std::endl;
+    }
     std::cout << "Query tokens (" << query_tokens.size() << " tokens): ";
     for (size_t i = 0; i < std::min(query_tokens.size(), size_t(10)); i++) {
         std::cout << query_tokens[i] << " ";
@@ -79,10 +299,18 @@ int main(int argc, char *argv[]) {
         std::cout << "... (" << (query_tokens.size() - 10) << " more)";
     }
     std::cout << std::endl;
-    std::cout << "Threshold: " << threshold << std::endl;
+    std::cout << "Threshold: " << opts.threshold << std::endl;
     std::cout << "================================" << std::endl;
 
     try {
+        // Shards share one hasher configuration (checked on load); the first
+        // one's header gives the type.
+        std::vector<ShardSpec> shards;
+        if (!manifest_file.empty()) {
+            shards = readShardManifest(manifest_file);
+            index_file = shards[0].index_file;
+        }
+
         // Read index header to infer WeightType
         std::cout << "Detecting index type..." << std::endl;
         IndexHeader header = readIndexHeader(index_file);
@@ -96,24 +324,44 @@ int main(int argc, char *argv[]) {
             case TFMode::SQUARE: std::cout << "square"; break;
             default: std::cout << "unknown"; break;
         }
-        std::cout << ", IDF=" << (header.use_idf ? "enabled" : "disabled") << std::endl;
+        std::cout << ", IDF=" << (header.use_idf ? "enabled" : "disabled");
+        if (header.isDoubleType()) {
+            std::cout << ", sampler=" << cwsSamplerName(header.sampler);
+        }
+        if (header.fingerprint_bits) {
+            std::cout << ", fingerprints=" << header.fingerprint_bits << "-bit";
+        }
+        std::cout << ", format=v" << header.version;
+        if (header.num_docs) {
+            std::cout << ", docs=" << header.num_docs;
+        }
+        if (header.chunk_length) {
+            std::cout << ", chunks=" << header.chunk_length << "-token (-l)";
+        }
+        std::cout << std::endl;
+
+        std::unique_ptr<MappedCorpus> corpus;
+        if (!corpus_file.empty()) {
+            corpus = std::make_unique<MappedCorpus>(corpus_file);
+        }
         
         if (header.isIntType()) {
             std::cout << "Using INT precision (optimized for raw TF without IDF)" << std::endl;
-            Query<int> query_engine;
-            query_engine.loadIndex(index_file);
-            std::cout << "Index loaded successfully. CWs=" << query_engine.getTotalCWCount() << std::endl;
-            std::cout << query_engine.getHasherInfo() << std::endl;
-            std::cout << "================================" << std::endl;
-            query_engine.query(query_tokens, threshold);
+            if (shards.empty()) {
+                runQueries<int, RawTF>(index_file, queries, opts, corpus.get());
+            } else {
+                runShardedQueries<int, RawTF>(shards, queries, opts);
+            }
         } else {
             std::cout << "Using DOUBLE precision (for advanced TF or IDF)" << std::endl;
-            Query<double> query_engine;
-            query_engine.loadIndex(index_file);
-            std::cout << "Index loaded successfully. CWs=" << query_engine.getTotalCWCount() << std::endl;
-            std::cout << query_engine.getHasherInfo() << std::endl;
-            std::cout << "================================" << std::endl;
-            query_engine.query(query_tokens, threshold);
+            // Dispatch the TF mode once; the query engine is specialized on it.
+            withTFPolicy(header.tf_mode, [&](auto tf) {
+                if (shards.empty()) {
+                    runQueries<double, decltype(tf)>(index_file, queries, opts, corpus.get());
+                } else {
+                    runShardedQueries<double, decltype(tf)>(shards, queries, opts);
+                }
+            });
         }
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
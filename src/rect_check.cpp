@@ -0,0 +1,75 @@
+#include <set>
+#include <random>
+#include <vector>
+#include <utility>
+#include <iostream>
+#include "./util/match_rect.hpp"
+
+using namespace std;
+
+// Brute-force check of mergeRects on random scans: runs of ends, touching
+// or with gaps between them, each with a few sorted disjoint start ranges
+// as Query::scanRects emits them. For every input the merged rectangles
+// must cover exactly the input's windows, none may be extendable by one
+// more end, and longestRect must find the longest window. Exits non-zero
+// on any failure; run by ctest.
+
+set<pair<int, int>> windows(const vector<MatchRect> &rects) {
+    set<pair<int, int>> out;
+    for (const MatchRect &r : rects) {
+        for (int i = r.start_lo; i <= r.start_hi; i++) {
+            for (int j = r.end_lo; j <= r.end_hi; j++) out.insert({i, j});
+        }
+    }
+    return out;
+}
+
+vector<MatchRect> randomScan(mt19937 &rng) {
+    vector<MatchRect> rects;
+    int end = 0;
+    int runs = 1 + rng() % 10;
+    for (int r = 0; r < runs; r++) {
+        if (rng() % 5 == 0) end += 2 + rng() % 3;   // a gap between runs
+        int len = 1 + rng() % 3;
+        int start = 0;
+        int ranges = rng() % 4;
+        for (int q = 0; q < ranges; q++) {
+            start += rng() % 3;
+            int width = rng() % 4;
+            if (start + width > end) break;
+            rects.push_back({start, start + width, end, end + len - 1});
+            start += width + 1;
+        }
+        end += len;
+    }
+    return rects;
+}
+
+int main(int argc, char *argv[]) {
+    int trials = argc > 1 ? stoi(argv[1]) : 20000;
+    mt19937 rng(1);
+    long long wrong_cover = 0, extendable = 0, wrong_longest = 0;
+    long long ranges = 0, rects = 0;
+    for (int t = 0; t < trials; t++) {
+        vector<MatchRect> scan = randomScan(rng);
+        vector<MatchRect> merged = mergeRects(scan);
+        set<pair<int, int>> expected = windows(scan);
+        if (windows(merged) != expected) wrong_cover++;
+        for (const MatchRect &r : merged) {
+            bool grows = true;
+            for (int i = r.start_lo; i <= r.start_hi && grows; i++) grows = expected.count({i, r.end_hi + 1}) > 0;
+            if (grows) extendable++;
+        }
+        if (!merged.empty()) {
+            int best = 0;
+            for (const auto &w : expected) best = max(best, w.second - w.first + 1);
+            if (merged[longestRect(merged)].span() != best) wrong_longest++;
+        }
+        ranges += scan.size();
+        rects += merged.size();
+    }
+    cout << trials << " scans: " << ranges << " ranges merged into " << rects << " rectangles" << endl;
+    cout << "wrong cover: " << wrong_cover << ", extendable: " << extendable << ", wrong longest: " << wrong_longest
+         << endl;
+    return wrong_cover || extendable || wrong_longest ? 1 : 0;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include "util.hpp"
+
+// Blocking FIFO of at most capacity items between pipeline stages. push
+// waits while the queue is full and pop while it is empty; after close, pop
+// drains what is left and then returns false. The time each side spends
+// waiting is accumulated so a stage's utilization can be reported.
+template<typename T>
+class BoundedQueue {
+private:
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+    std::mutex mu;
+    std::condition_variable not_full, not_empty;
+    double push_wait = 0, pop_wait = 0;   // seconds, summed over callers
+
+public:
+    explicit BoundedQueue(size_t capacity_) : capacity(capacity_ ? capacity_ : 1) {}
+
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mu);
+        if (items.size() >= capacity && !closed) {
+            auto st = timerStart();
+            not_full.wait(lock, [&] { return items.size() < capacity || closed; });
+            push_wait += timerCheck(st);
+        }
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+    }
+
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(mu);
+        if (items.empty() && !closed) {
+            auto st = timerStart();
+            not_empty.wait(lock, [&] { return !items.empty() || closed; });
+            pop_wait += timerCheck(st);
+        }
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    // No more pushes; wakes every waiting pop (and push, which then proceeds).
+    void close() {
+        std::lock_guard<std::mutex> lock(mu);
+        closed = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+    double pushWaitSeconds() {
+        std::lock_guard<std::mutex> lock(mu);
+        return push_wait;
+    }
+
+    double popWaitSeconds() {
+        std::lock_guard<std::mutex> lock(mu);
+        return pop_wait;
+    }
+};
@@ -0,0 +1,147 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <ostream>
+#include <algorithm>
+#include <numeric>
+#include "json.hpp"
+#include "memory.hpp"
+
+// Hot-path counters for one (hash function, document) step of a builder.
+// Plain integers bumped in registers and folded into BuildStats once per
+// step, so they stay on in production builds.
+struct BuildCounters {
+    long long keys = 0;          // candidate keys generated (monotonic)
+    long long keys_skipped = 0;  // occurrences dropped by the active-key filter
+    long long searches = 0;      // staircase searches (splay tree or std::set)
+    long long removals = 0;      // staircase removals
+    long long ranges = 0;        // ranges expanded (allalign)
+    long long cws = 0;           // CWs emitted
+    double seconds = 0;
+
+    void add(const BuildCounters &o) {
+        keys += o.keys;
+        keys_skipped += o.keys_skipped;
+        searches += o.searches;
+        removals += o.removals;
+        ranges += o.ranges;
+        cws += o.cws;
+        seconds += o.seconds;
+    }
+
+    void writeJson(JsonWriter &json) const {
+        json.field("keys", keys)
+            .field("keys_skipped", keys_skipped)
+            .field("searches", searches)
+            .field("removals", removals)
+            .field("ranges", ranges)
+            .field("cws", cws)
+            .field("seconds", seconds);
+    }
+};
+
+// Build telemetry: counters summed per hash function and per document, plus
+// wall time of the phases the driver reports.
+class BuildStats {
+private:
+    struct DocEntry {
+        double seconds = 0;
+        long long cws = 0;
+        long long keys = 0;
+        long long length = -1;   // tokens; -1 = take from the docs passed to writeJson
+    };
+
+    std::vector<BuildCounters> per_hid;
+    std::vector<DocEntry> per_doc;
+    std::vector<std::pair<std::string, double>> phases;
+
+public:
+    void reset(int k, int doc_num) {
+        per_hid.assign(k, BuildCounters());
+        per_doc.assign(doc_num, DocEntry());
+    }
+
+    void record(int hid, int doc_id, const BuildCounters &c) {
+        per_hid[hid].add(c);
+        DocEntry &d = per_doc[doc_id];
+        d.seconds += c.seconds;
+        d.cws += c.cws;
+        d.keys += c.keys;
+    }
+
+    // Fold in the stats of a builder run over a batch of documents that are
+    // documents first_doc.. of the corpus (pipelined build).
+    void merge(const BuildStats &batch, int first_doc, const std::vector<std::vector<int>> &batch_docs) {
+        if (per_hid.size() < batch.per_hid.size()) per_hid.resize(batch.per_hid.size());
+        for (size_t hid = 0; hid < batch.per_hid.size(); hid++) {
+            per_hid[hid].add(batch.per_hid[hid]);
+        }
+        size_t end = first_doc + batch.per_doc.size();
+        if (per_doc.size() < end) per_doc.resize(end);
+        for (size_t d = 0; d < batch.per_doc.size(); d++) {
+            per_doc[first_doc + d] = batch.per_doc[d];
+            per_doc[first_doc + d].length = d < batch_docs.size() ? (long long)batch_docs[d].size() : 0;
+        }
+    }
+
+    void addPhase(const std::string &name, double seconds) {
+        phases.emplace_back(name, seconds);
+    }
+
+    double docSeconds(int doc_id) const { return per_doc[doc_id].seconds; }
+    long long docCWs(int doc_id) const { return per_doc[doc_id].cws; }
+
+    BuildCounters total() const {
+        BuildCounters sum;
+        for (const auto &c : per_hid) sum.add(c);
+        return sum;
+    }
+
+    // Document ids ordered by build time, slowest first.
+    std::vector<int> slowestDocs(int n) const {
+        std::vector<int> ids(per_doc.size());
+        std::iota(ids.begin(), ids.end(), 0);
+        n = std::max(0, std::min<int>(n, ids.size()));
+        std::partial_sort(ids.begin(), ids.begin() + n, ids.end(),
+                          [&](int a, int b) { return per_doc[a].seconds > per_doc[b].seconds; });
+        ids.resize(n);
+        return ids;
+    }
+
+    void writeJson(std::ostream &os, const std::vector<std::vector<int>> &docs, int top_n,
+                   const MemoryReport *memory = nullptr) const {
+        JsonWriter json(os);
+        json.beginObject();
+        json.key("phases").beginObject();
+        for (const auto &p : phases) json.field(p.first, p.second);
+        json.endObject();
+        json.key("total").beginObject();
+        total().writeJson(json);
+        json.endObject();
+        json.key("per_hash").beginArray();
+        for (size_t hid = 0; hid < per_hid.size(); hid++) {
+            json.beginObject().field("hid", (int)hid);
+            per_hid[hid].writeJson(json);
+            json.endObject();
+        }
+        json.endArray();
+        json.key("slowest_docs").beginArray();
+        for (int id : slowestDocs(top_n)) {
+            json.beginObject()
+                .field("doc_id", id)
+                .field("length", per_doc[id].length >= 0 ? per_doc[id].length
+                                                          : (long long)(id < (int)docs.size() ? docs[id].size() : 0))
+                .field("seconds", per_doc[id].seconds)
+                .field("cws", per_doc[id].cws)
+                .field("keys", per_doc[id].keys)
+                .endObject();
+        }
+        json.endArray();
+        if (memory) {
+            json.key("memory");
+            memory->writeJson(json);
+        }
+        json.endObject();
+        os << "\n";
+    }
+};
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+// Streaming 64-bit checksum for index files. Bytes are consumed as 8-byte
+// little-endian words, each folded in with a multiply-rotate step, and the
+// result depends only on the byte sequence, not on how update() calls split
+// it. Detects truncation and corruption; not a cryptographic hash.
+class Checksum {
+private:
+    static constexpr uint64_t kPrime1 = 0x9e3779b185ebca87ULL;
+    static constexpr uint64_t kPrime2 = 0xc2b2ae3d27d4eb4fULL;
+
+    uint64_t h = 0x27d4eb2f165667c5ULL;
+    uint64_t length = 0;
+    uint64_t pending = 0;   // bytes of an incomplete word, low byte first
+    int pending_bytes = 0;
+
+    static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+    void fold(uint64_t word) {
+        h ^= rotl(word * kPrime2, 31) * kPrime1;
+        h = rotl(h, 27) * kPrime1 + 0x85ebca77c2b2ae63ULL;
+    }
+
+public:
+    void update(const void *data, size_t n) {
+        const unsigned char *p = static_cast<const unsigned char *>(data);
+        length += n;
+        while (n > 0 && pending_bytes > 0) {
+            pending |= static_cast<uint64_t>(*p++) << (8 * pending_bytes);
+            n--;
+            if (++pending_bytes == 8) {
+                fold(pending);
+                pending = 0;
+                pending_bytes = 0;
+            }
+        }
+        for (; n >= 8; p += 8, n -= 8) {
+            uint64_t word;
+            std::memcpy(&word, p, sizeof(word));
+            fold(word);
+        }
+        for (; n > 0; n--) {
+            pending |= static_cast<uint64_t>(*p++) << (8 * pending_bytes++);
+        }
+    }
+
+    uint64_t value() const {
+        uint64_t z = h ^ rotl(pending * kPrime2, 31) ^ (length * kPrime1);
+        z = (z ^ (z >> 33)) * 0xff51afd7ed558ccdULL;
+        z = (z ^ (z >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+        return z ^ (z >> 33);
+    }
+};
@@ -0,0 +1,234 @@
+#pragma once
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include "cw.hpp"
+#include "checksum.hpp"
+
+// Columnar storage for the CWs of one hash function: hash values, document
+// ids and the four window bounds each live in their own array, so collision
+// probing streams over v alone and only touches the other columns for hits.
+//
+// The on-disk layout stays the array-of-records one written by
+// CW::saveToFile (T, a, b, c, d, v per CW); writeRecords/readRecords convert
+// in blocks instead of issuing six stream calls per CW, and feed the bytes to
+// an optional Checksum.
+//
+// Fingerprinted indexes store a 32- or 16-bit fingerprint of v in place of
+// v (T, a, b, c, d, fp per CW). Their columns hold fp instead of v, with
+// 16-bit fingerprints widened so both widths share the int equality kernels.
+template<typename WeightType>
+class CWColumns {
+public:
+    static constexpr size_t kRecordBytes = 5 * sizeof(int) + sizeof(WeightType);
+
+    std::vector<WeightType> v;
+    std::vector<int> T, a, b, c, d;
+    std::vector<uint32_t> fp;   // fingerprinted indexes only; v is then empty
+
+    size_t size() const { return T.size(); }
+    bool empty() const { return T.empty(); }
+
+    static size_t recordBytes(int fp_bits) {
+        return fp_bits ? 5 * sizeof(int) + fp_bits / 8 : kRecordBytes;
+    }
+
+    // Top fp_bits bits of a 64-bit mix of the value's bit pattern, so values
+    // that differ anywhere differ in their fingerprint with probability
+    // 1 - 2^-fp_bits.
+    static uint32_t fingerprint(WeightType value, int fp_bits) {
+        uint64_t z = 0;
+        std::memcpy(&z, &value, sizeof(WeightType));
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        z ^= z >> 31;
+        return static_cast<uint32_t>(z >> (64 - fp_bits));
+    }
+
+    void reserve(size_t n) {
+        v.reserve(n);
+        T.reserve(n);
+        a.reserve(n);
+        b.reserve(n);
+        c.reserve(n);
+        d.reserve(n);
+    }
+
+    void resize(size_t n) {
+        v.resize(n);
+        T.resize(n);
+        a.resize(n);
+        b.resize(n);
+        c.resize(n);
+        d.resize(n);
+    }
+
+    void push_back(const CW<WeightType> &cw) {
+        v.push_back(cw.v);
+        T.push_back(cw.T);
+        a.push_back(cw.a);
+        b.push_back(cw.b);
+        c.push_back(cw.c);
+        d.push_back(cw.d);
+    }
+
+    // v is zero for fingerprinted rows.
+    CW<WeightType> get(size_t i) const {
+        return CW<WeightType>(T[i], v.empty() ? WeightType{} : v[i], a[i], b[i], c[i], d[i]);
+    }
+
+    long long memoryBytes() const {
+        return (long long)v.capacity() * sizeof(WeightType) +
+               (long long)(T.capacity() + a.capacity() + b.capacity() + c.capacity() + d.capacity()) * sizeof(int) +
+               (long long)fp.capacity() * sizeof(uint32_t);
+    }
+
+    static void packRecord(char *p, int T, int a, int b, int c, int d, WeightType v) {
+        std::memcpy(p, &T, sizeof(int));
+        std::memcpy(p + 4, &a, sizeof(int));
+        std::memcpy(p + 8, &b, sizeof(int));
+        std::memcpy(p + 12, &c, sizeof(int));
+        std::memcpy(p + 16, &d, sizeof(int));
+        std::memcpy(p + 20, &v, sizeof(WeightType));
+    }
+
+    // Write n records in CW::saveToFile layout.
+    static void writeRecords(std::ofstream &file, const CW<WeightType> *cws, size_t n, Checksum *sum = nullptr) {
+        const size_t block = 4096;
+        std::vector<char> buf(block * kRecordBytes);
+        for (size_t start = 0; start < n; start += block) {
+            size_t m = std::min(block, n - start);
+            for (size_t i = 0; i < m; i++) {
+                const CW<WeightType> &cw = cws[start + i];
+                packRecord(&buf[i * kRecordBytes], cw.T, cw.a, cw.b, cw.c, cw.d, cw.v);
+            }
+            file.write(buf.data(), m * kRecordBytes);
+            if (sum) sum->update(buf.data(), m * kRecordBytes);
+        }
+    }
+
+    // Write n records with v replaced by its fp_bits-bit fingerprint.
+    static void writeFingerprintRecords(std::ofstream &file, const CW<WeightType> *cws, size_t n, int fp_bits,
+                                        Checksum *sum = nullptr) {
+        const size_t block = 4096, bytes = recordBytes(fp_bits);
+        std::vector<char> buf(block * bytes);
+        for (size_t start = 0; start < n; start += block) {
+            size_t m = std::min(block, n - start);
+            for (size_t i = 0; i < m; i++) {
+                const CW<WeightType> &cw = cws[start + i];
+                char *p = &buf[i * bytes];
+                int ints[5] = {cw.T, cw.a, cw.b, cw.c, cw.d};
+                std::memcpy(p, ints, sizeof(ints));
+                uint32_t f = fingerprint(cw.v, fp_bits);
+                if (fp_bits == 16) {
+                    uint16_t f16 = static_cast<uint16_t>(f);
+                    std::memcpy(p + 20, &f16, sizeof(f16));
+                } else {
+                    std::memcpy(p + 20, &f, sizeof(f));
+                }
+            }
+            file.write(buf.data(), m * bytes);
+            if (sum) sum->update(buf.data(), m * bytes);
+        }
+    }
+
+    void writeRecords(std::ofstream &file, Checksum *sum = nullptr) const {
+        const size_t block = 4096;
+        std::vector<char> buf(block * kRecordBytes);
+        for (size_t start = 0; start < size(); start += block) {
+            size_t m = std::min(block, size() - start);
+            for (size_t i = 0; i < m; i++) {
+                size_t j = start + i;
+                packRecord(&buf[i * kRecordBytes], T[j], a[j], b[j], c[j], d[j], v[j]);
+            }
+            file.write(buf.data(), m * kRecordBytes);
+            if (sum) sum->update(buf.data(), m * kRecordBytes);
+        }
+    }
+
+    static void readRecords(std::ifstream &file, CW<WeightType> *cws, size_t n, Checksum *sum = nullptr) {
+        const size_t block = 4096;
+        std::vector<char> buf(block * kRecordBytes);
+        for (size_t start = 0; start < n; start += block) {
+            size_t m = std::min(block, n - start);
+            if (!file.read(buf.data(), m * kRecordBytes)) {
+                throw std::runtime_error("Index file truncated while reading CWs");
+            }
+            if (sum) sum->update(buf.data(), m * kRecordBytes);
+            for (size_t i = 0; i < m; i++) {
+                const char *p = &buf[i * kRecordBytes];
+                CW<WeightType> &cw = cws[start + i];
+                std::memcpy(&cw.T, p, sizeof(int));
+                std::memcpy(&cw.a, p + 4, sizeof(int));
+                std::memcpy(&cw.b, p + 8, sizeof(int));
+                std::memcpy(&cw.c, p + 12, sizeof(int));
+                std::memcpy(&cw.d, p + 16, sizeof(int));
+                std::memcpy(&cw.v, p + 20, sizeof(WeightType));
+            }
+        }
+    }
+
+    // Replace the contents with n records in CW::saveToFile layout.
+    void readRecords(std::ifstream &file, size_t n, Checksum *sum = nullptr) {
+        resize(n);
+        fp.clear();
+        const size_t block = 4096;
+        std::vector<char> buf(block * kRecordBytes);
+        for (size_t start = 0; start < n; start += block) {
+            size_t m = std::min(block, n - start);
+            if (!file.read(buf.data(), m * kRecordBytes)) {
+                throw std::runtime_error("Index file truncated while reading CWs");
+            }
+            if (sum) sum->update(buf.data(), m * kRecordBytes);
+            for (size_t i = 0; i < m; i++) {
+                const char *p = &buf[i * kRecordBytes];
+                size_t j = start + i;
+                std::memcpy(&T[j], p, sizeof(int));
+                std::memcpy(&a[j], p + 4, sizeof(int));
+                std::memcpy(&b[j], p + 8, sizeof(int));
+                std::memcpy(&c[j], p + 12, sizeof(int));
+                std::memcpy(&d[j], p + 16, sizeof(int));
+                std::memcpy(&v[j], p + 20, sizeof(WeightType));
+            }
+        }
+    }
+
+    // Replace the contents with n fingerprinted records; fills fp, not v.
+    void readFingerprintRecords(std::ifstream &file, size_t n, int fp_bits, Checksum *sum = nullptr) {
+        v.clear();
+        T.resize(n);
+        a.resize(n);
+        b.resize(n);
+        c.resize(n);
+        d.resize(n);
+        fp.resize(n);
+        const size_t block = 4096, bytes = recordBytes(fp_bits);
+        std::vector<char> buf(block * bytes);
+        for (size_t start = 0; start < n; start += block) {
+            size_t m = std::min(block, n - start);
+            if (!file.read(buf.data(), m * bytes)) {
+                throw std::runtime_error("Index file truncated while reading CWs");
+            }
+            if (sum) sum->update(buf.data(), m * bytes);
+            for (size_t i = 0; i < m; i++) {
+                const char *p = &buf[i * bytes];
+                size_t j = start + i;
+                std::memcpy(&T[j], p, sizeof(int));
+                std::memcpy(&a[j], p + 4, sizeof(int));
+                std::memcpy(&b[j], p + 8, sizeof(int));
+                std::memcpy(&c[j], p + 12, sizeof(int));
+                std::memcpy(&d[j], p + 16, sizeof(int));
+                if (fp_bits == 16) {
+                    uint16_t f16;
+                    std::memcpy(&f16, p + 20, sizeof(f16));
+                    fp[j] = f16;
+                } else {
+                    std::memcpy(&fp[j], p + 20, sizeof(uint32_t));
+                }
+            }
+        }
+    }
+};
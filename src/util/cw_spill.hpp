@@ -0,0 +1,161 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <stdexcept>
+#include <unistd.h>
+#include "cw.hpp"
+#include "cw_columns.hpp"
+#include "checksum.hpp"
+
+// Bounded in-memory CW lists for builds under a memory budget. Each hash
+// function's list is reserved budget / k bytes of CWs up front and never
+// grows past them: it is handed to spill(), which appends it to a temporary
+// file as one run and empties it, before it would need to, so the lists'
+// capacity, not just their size, stays within the budget. Runs are full records in document order, so a
+// hash function's block of the index is its runs in order followed by
+// what is still in memory, and copyBlock() streams it into the index with
+// one seek per run.
+//
+// The spill file is created in the given directory and unlinked at once, so
+// it never outlives the process.
+template<typename WeightType>
+class CWSpill {
+public:
+    // Fewer CWs per run than this and the runs degrade into small random
+    // reads at assembly time.
+    static constexpr size_t kMinRunCWs = 256;
+
+private:
+    struct Run {
+        uint64_t offset = 0;
+        uint64_t count = 0;
+    };
+
+    std::vector<std::vector<Run>> runs;   // per hash function, in order
+    std::vector<uint64_t> spilled;        // CWs per hash function
+    std::vector<size_t> last_size;        // list size at the previous full() check
+    std::vector<size_t> max_step;         // most CWs a step has added to the list
+    size_t run_cws = 0;
+    std::ofstream out;
+    std::ifstream in;
+    uint64_t end = 0;
+    long long total_runs = 0;
+
+    void writeRun(int hid, const CW<WeightType> *cws, size_t n) {
+        if (n == 0) return;
+        CWColumns<WeightType>::writeRecords(out, cws, n);
+        if (!out) {
+            throw std::runtime_error("Failed writing spill file (disk full?)");
+        }
+        runs[hid].push_back({end, n});
+        end += n * CWColumns<WeightType>::kRecordBytes;
+        spilled[hid] += n;
+        total_runs++;
+    }
+
+public:
+    CWSpill(int k, long long budget_bytes, const std::string &dir)
+        : runs(k), spilled(k, 0), last_size(k, 0), max_step(k, 0) {
+        run_cws = (size_t)(budget_bytes / ((long long)k * sizeof(CW<WeightType>)));
+        if (run_cws < kMinRunCWs) {
+            throw std::invalid_argument("Memory budget too small for " + std::to_string(k) +
+                                        " hash functions; need at least " +
+                                        std::to_string(minBudget(k)) + " bytes");
+        }
+        std::string path = (dir.empty() ? std::string(".") : dir) + "/cw-spill-XXXXXX";
+        std::vector<char> name(path.begin(), path.end());
+        name.push_back('\0');
+        int fd = mkstemp(name.data());
+        if (fd < 0) {
+            throw std::runtime_error("Cannot create spill file in: " + dir);
+        }
+        close(fd);
+        out.open(name.data(), std::ios::binary | std::ios::trunc);
+        in.open(name.data(), std::ios::binary);
+        unlink(name.data());
+        if (!out.is_open() || !in.is_open()) {
+            throw std::runtime_error("Cannot open spill file: " + std::string(name.data()));
+        }
+    }
+
+    static long long minBudget(int k) { return (long long)k * kMinRunCWs * sizeof(CW<WeightType>); }
+
+    // CWs a hash function's list may hold before it must be spilled.
+    size_t runCWs() const { return run_cws; }
+
+    // Give a list its full capacity up front, so it never grows by doubling.
+    void reserve(std::vector<CW<WeightType>> &list) const { list.reserve(run_cws); }
+
+    // Called after each step that appended to hid's list: whether to spill
+    // it now, because the largest step seen so far would take it past its
+    // reserved capacity. A larger step than any before can still grow the
+    // list once; spill() then gives the excess back.
+    bool full(int hid, const std::vector<CW<WeightType>> &list) {
+        max_step[hid] = std::max(max_step[hid], list.size() - std::min(list.size(), last_size[hid]));
+        last_size[hid] = list.size();
+        return list.size() + max_step[hid] > run_cws;
+    }
+
+    // Append list to the spill file as the next run of hid and empty it,
+    // keeping (only) its reserved capacity for the next run.
+    void spill(int hid, std::vector<CW<WeightType>> &list) {
+        writeRun(hid, list.data(), list.size());
+        list.clear();
+        if (list.capacity() > run_cws) {
+            std::vector<CW<WeightType>>().swap(list);
+            reserve(list);
+        }
+        last_size[hid] = 0;
+    }
+
+    // Append more to hid's list, spilling the list first if it has no room
+    // and writing more straight to the file as a run of its own if it
+    // exceeds a list's capacity.
+    void append(int hid, std::vector<CW<WeightType>> &list, const std::vector<CW<WeightType>> &more) {
+        if (list.size() + more.size() > run_cws) spill(hid, list);
+        if (more.size() > run_cws) {
+            writeRun(hid, more.data(), more.size());
+        } else {
+            list.insert(list.end(), more.begin(), more.end());
+        }
+    }
+
+    uint64_t spilledCWs(int hid) const { return spilled[hid]; }
+    long long spilledCWs() const {
+        long long sum = 0;
+        for (uint64_t n : spilled) sum += n;
+        return sum;
+    }
+    long long runCount() const { return total_runs; }
+    uint64_t spilledBytes() const { return end; }
+
+    // Write hid's runs followed by tail (its CWs still in memory) to file as
+    // one index block, feeding sum. fp_bits as in Hasher::fingerprintBits.
+    void copyBlock(int hid, const std::vector<CW<WeightType>> &tail, std::ofstream &file, Checksum &sum,
+                   int fp_bits) {
+        auto emit = [&](const CW<WeightType> *cws, size_t n) {
+            if (fp_bits) {
+                CWColumns<WeightType>::writeFingerprintRecords(file, cws, n, fp_bits, &sum);
+            } else {
+                CWColumns<WeightType>::writeRecords(file, cws, n, &sum);
+            }
+        };
+        out.flush();
+        std::vector<CW<WeightType>> chunk;
+        const uint64_t chunk_cws = 1 << 16;
+        for (const Run &r : runs[hid]) {
+            in.clear();
+            in.seekg(r.offset);
+            for (uint64_t done = 0; done < r.count; done += chunk.size()) {
+                chunk.resize(std::min(chunk_cws, r.count - done));
+                CWColumns<WeightType>::readRecords(in, chunk.data(), chunk.size());
+                emit(chunk.data(), chunk.size());
+            }
+        }
+        emit(tail.data(), tail.size());
+    }
+};
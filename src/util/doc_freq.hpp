@@ -0,0 +1,87 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+// Document frequency of every token of a corpus, plus the number of token
+// occurrences outside [0, tokenNum), which are skipped.
+struct DocFrequencies {
+    std::vector<uint32_t> df;
+    long long num_docs = 0;
+    long long tokens = 0;
+    long long out_of_range = 0;
+
+    // log(N / df), or 0 for tokens that never occur (Hasher::calculateIDF).
+    std::vector<double> idf() const {
+        std::vector<double> out(df.size(), 0.0);
+        for (size_t t = 0; t < df.size(); t++) {
+            if (df[t] > 0) out[t] = std::log(static_cast<double>(num_docs) / df[t]);
+        }
+        return out;
+    }
+};
+
+// Count document frequencies over num_docs documents, doc(i) returning a
+// {const int *tokens, int length} view (MappedCorpus::Doc or equivalent).
+// Documents are split into contiguous ranges of about equal token count, one
+// per thread. Each thread keeps a dense count array and an array stamping
+// every token with the last document it was seen in, so a token is counted
+// once per document without a per-document set or any clearing.
+template<typename DocFn>
+DocFrequencies countDocFrequencies(long long num_docs, int tokenNum, int threads, DocFn doc) {
+    DocFrequencies out;
+    out.num_docs = num_docs;
+    out.df.assign(tokenNum, 0);
+    threads = (int)std::max(1LL, std::min<long long>(threads, num_docs));
+
+    std::vector<long long> bounds{0};
+    if (threads > 1) {
+        long long total = 0;
+        for (long long i = 0; i < num_docs; i++) total += doc(i).length;
+        long long seen = 0;
+        for (long long i = 0; i < num_docs && (int)bounds.size() < threads; i++) {
+            seen += doc(i).length;
+            if (seen * threads >= total * (long long)bounds.size()) bounds.push_back(i + 1);
+        }
+    }
+    bounds.push_back(num_docs);
+    int parts = (int)bounds.size() - 1;
+
+    std::vector<std::vector<uint32_t>> counts(parts);
+    std::vector<long long> tokens(parts, 0), skipped(parts, 0);
+    auto work = [&](int p) {
+        std::vector<uint32_t> &df = p == 0 ? out.df : counts[p];
+        if (p != 0) df.assign(tokenNum, 0);
+        std::vector<uint32_t> stamp(tokenNum, 0);
+        for (long long i = bounds[p]; i < bounds[p + 1]; i++) {
+            auto d = doc(i);
+            uint32_t epoch = (uint32_t)(i - bounds[p] + 1);
+            for (int j = 0; j < d.length; j++) {
+                int t = d.tokens[j];
+                if (t < 0 || t >= tokenNum) {
+                    skipped[p]++;
+                    continue;
+                }
+                if (stamp[t] != epoch) {
+                    stamp[t] = epoch;
+                    df[t]++;
+                }
+            }
+            tokens[p] += d.length;
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int p = 1; p < parts; p++) pool.emplace_back(work, p);
+    work(0);
+    for (auto &t : pool) t.join();
+
+    for (int p = 0; p < parts; p++) {
+        out.tokens += tokens[p];
+        out.out_of_range += skipped[p];
+        if (p == 0) continue;
+        for (int t = 0; t < tokenNum; t++) out.df[t] += counts[p][t];
+    }
+    return out;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include "hasher.hpp"
+#include "memory.hpp"
+
+// Weights of every (token, x-th occurrence) pair of one document, computed
+// once per document and shared by the k hash functions. tf[x] depends only
+// on x and the document's max frequency; with IDF (DOUBLE only), each token
+// also gets a row of fused tf[x] * idf[token] values, laid out like
+// RankHashTable's rows. Either way row(t)[x - 1] is the weight that
+// Hasher::evalWeighted / evalRun take as is.
+template<typename WeightType>
+class DocWeights {
+private:
+    std::vector<WeightType> tf;     // tf[x], 1 <= x <= max_freq
+    std::vector<int> base;          // per token: first slot of its fused row
+    std::vector<WeightType> fused;  // per slot: tf[x] * idf[token]
+    bool use_idf = false;
+    int max_freq = 0;
+
+public:
+    explicit DocWeights(int tokenNum) : base(tokenNum) {}
+
+    long long memoryBytes() const {
+        return vectorBytes(tf) + vectorBytes(base) + vectorBytes(fused);
+    }
+
+    // cnt is tokenNum-sized zeroed scratch and is left zeroed on return;
+    // tfOf(x, max_freq) is the TF weight of an x-th occurrence.
+    template<typename TFFunc>
+    void build(const std::vector<int> &doc, std::vector<int> &cnt, const Hasher<WeightType> &hasher, TFFunc tfOf) {
+        build(doc.data(), (int)doc.size(), cnt, hasher, tfOf);
+    }
+
+    template<typename TFFunc>
+    void build(const int *doc, int n, std::vector<int> &cnt, const Hasher<WeightType> &hasher, TFFunc tfOf) {
+        max_freq = 0;
+        for (int i = 0; i < n; i++) {
+            max_freq = std::max(max_freq, ++cnt[doc[i]]);
+        }
+        tf.resize(max_freq + 1);
+        for (int x = 1; x <= max_freq; x++) {
+            tf[x] = tfOf(x, max_freq);
+        }
+
+        use_idf = std::is_same_v<WeightType, double> && hasher.isIDFEnabled();
+        if (use_idf) {
+            fused.resize(n);
+            int offset = 0;
+            for (int i = 0; i < n; i++) {
+                int t = doc[i];
+                if (cnt[t] == 0) continue;  // row already laid out
+                base[t] = offset;
+                double idf = hasher.idfOf(t);
+                for (int x = 1; x <= cnt[t]; x++) {
+                    fused[offset + x - 1] = static_cast<double>(tf[x]) * idf;
+                }
+                offset += cnt[t];
+                cnt[t] = 0;
+            }
+        } else {
+            for (int i = 0; i < n; i++) {
+                cnt[doc[i]] = 0;
+            }
+        }
+    }
+
+    int maxFreq() const { return max_freq; }
+
+    // Weights of the 1st, 2nd, ... occurrence of token.
+    const WeightType *row(int token) const {
+        return use_idf ? fused.data() + base[token] : tf.data() + 1;
+    }
+
+    WeightType weight(int token, int x) const { return row(token)[x - 1]; }
+};
@@ -0,0 +1,189 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <ostream>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include "cw.hpp"
+#include "memory.hpp"
+
+// Shape of a binary corpus as far as index size is concerned: per-document
+// length and token repetition (length / distinct tokens).
+struct CorpusShape {
+    long long docs = 0;
+    long long tokens = 0;
+    int max_length = 0;
+    double sum_repeat_sq = 0;    // sum over docs of n * ln(n / distinct)^2
+    double sum_n_log_n = 0;      // sum over docs of n * ln(n)
+    int vocab_used = 0;          // distinct tokens over the corpus
+};
+
+// Stream the corpus one document at a time (memory: one document plus a
+// tokenNum-sized stamp array). doc_limit = 0 reads every document. If
+// lengths is given, it receives the length of every document.
+inline CorpusShape scanCorpusShape(const std::string &bin_file, int tokenNum, int doc_limit = 0,
+                                   std::vector<int> *lengths = nullptr) {
+    std::ifstream ifs(bin_file, std::ios::binary);
+    if (!ifs) {
+        throw std::runtime_error("Cannot open file for reading: " + bin_file);
+    }
+    CorpusShape shape;
+    std::vector<int> doc, stamp(tokenNum, -1);
+    int size;
+    while ((doc_limit == 0 || shape.docs < doc_limit) && ifs.read((char *)&size, sizeof(int))) {
+        doc.resize(size);
+        ifs.read((char *)doc.data(), sizeof(int) * size);
+        int distinct = 0;
+        for (int t : doc) {
+            if (t < 0 || t >= tokenNum) {
+                throw std::out_of_range("Token id " + std::to_string(t) + " outside vocabulary of size " +
+                                        std::to_string(tokenNum) + " (use -v)");
+            }
+            if (stamp[t] != shape.docs) {
+                stamp[t] = shape.docs;
+                distinct++;
+            }
+        }
+        if (size > 0) {
+            double r = std::log((double)size / distinct);
+            shape.sum_repeat_sq += size * r * r;
+            shape.sum_n_log_n += size * std::log((double)size);
+        }
+        if (lengths) lengths->push_back(size);
+        shape.tokens += size;
+        shape.max_length = std::max(shape.max_length, size);
+        shape.docs++;
+    }
+    for (int s : stamp) shape.vocab_used += s >= 0;
+    return shape;
+}
+
+// Build options beyond the builder that change memory or the index file.
+struct EstimateOptions {
+    long long mem_budget = 0;     // --mem-budget; 0 = none
+    int pipeline_workers = 0;     // --pipeline; 0 = load the whole corpus
+    int batch_docs = 64;          // --batch
+    int queue_batches = 0;        // 0 = 2 per worker, as PipelineOptions
+    bool remap_vocab = false;     // --remap-vocab
+};
+
+struct IndexEstimate {
+    double cws = 0;               // CWs over all hash functions
+    long long index_bytes = 0;    // index file size
+    long long corpus_bytes = 0;   // documents held: all, or those of batches in flight
+    long long cw_bytes = 0;       // CW vectors at their final size (capped by the budget)
+    long long batch_bytes = 0;    // CWs of pipeline batches being built or awaiting the writer
+    long long idf_bytes = 0;
+    long long vocab_bytes = 0;    // vocabulary map and occurrence counts
+    long long scratch_bytes = 0;  // per builder, times the pipeline's workers
+    long long spill_bytes = 0;    // spill file on disk under a memory budget
+    long long peak_bytes = 0;     // expected peak: vectors ~1.5x size after doubling growth
+    long long peak_worst = 0;     // vectors at 2x size plus one reallocation in flight
+};
+
+// Per-hash CW count model, fitted on synthetic Zipfian corpora (see gencorpus):
+// monotonic and allalign emit one CW per token for documents without repeated
+// tokens, plus an excess growing with the square of ln(length / distinct);
+// single-column emits about n (ln n - 0.4). Expect within about 30%; the
+// planner's sampled fit is tighter.
+//
+// With options: a memory budget caps the CW lists at the budget (they are
+// reserved in full) and puts the rest in the spill file; a pipeline holds
+// only the documents and CWs of its batches in flight, which, under a
+// budget, share it half and half with the writer's lists; a remapped
+// vocabulary adds its map to the index and to memory.
+inline IndexEstimate estimateIndex(const CorpusShape &shape, int k, int tokenNum,
+                                   const std::string &builder, bool double_weights, bool use_idf,
+                                   int fp_bits = 0, const EstimateOptions &opts = EstimateOptions()) {
+    double per_hash;
+    long long scratch;
+    if (builder == "monotonic") {
+        per_hash = shape.tokens + 0.45 * shape.sum_repeat_sq;
+        // first/freq/mini, weight and rank rows, plus per-document next,
+        // keys and staircase nodes
+        scratch = 3LL * tokenNum * 8 + 3LL * tokenNum * 4 + (long long)shape.max_length * 96;
+    } else if (builder == "allalign") {
+        per_hash = shape.tokens + 0.7 * shape.sum_repeat_sq;
+        scratch = 7LL * tokenNum * 4 + (long long)shape.max_length * 48;
+    } else if (builder == "single" || builder == "singlecolumn") {
+        per_hash = std::max((double)shape.tokens, shape.sum_n_log_n - 0.4 * shape.tokens);
+        scratch = 6LL * tokenNum * 4 + (long long)shape.max_length * 40;
+    } else {
+        throw std::invalid_argument("Unknown builder '" + builder + "'. Valid: allalign, monotonic, single");
+    }
+
+    IndexEstimate e;
+    size_t weight = fp_bits ? fp_bits / 8 : double_weights ? sizeof(double) : sizeof(int);
+    size_t cw_size = double_weights ? sizeof(CW<double>) : sizeof(CW<int>);
+    e.cws = per_hash * k;
+    // Magic and version, the hasher's k, tokenNum, use_idf, mode word and
+    // seed, vocabulary map, document count, chunk length, block table and
+    // header checksum
+    long long record_bytes = 5 * sizeof(int) + weight;
+    e.index_bytes = 2 * sizeof(uint32_t) + 3 * sizeof(int) + sizeof(bool) + 4 * sizeof(uint64_t) +
+                    (use_idf ? (long long)tokenNum * sizeof(double) : 0) +
+                    (opts.remap_vocab ? sizeof(uint32_t) + (long long)shape.vocab_used * sizeof(int) : 0) +
+                    (long long)k * 3 * sizeof(uint64_t) + (long long)(e.cws * record_bytes);
+    long long all_docs = shape.tokens * sizeof(int) + shape.docs * sizeof(std::vector<int>);
+    long long all_cws = (long long)(e.cws * cw_size);
+    e.idf_bytes = (long long)tokenNum * sizeof(double);
+    // to_dense and to_orig, plus the occurrence counts they are built from
+    e.vocab_bytes = opts.remap_vocab ? (long long)tokenNum * (2 * sizeof(int) + sizeof(long long)) : 0;
+    e.scratch_bytes = scratch;
+
+    // Expected and worst-case bytes of CW lists reaching all_cws, grown by
+    // doubling; under a budget they are reserved at it instead.
+    auto lists = [](long long bytes, long long budget, int parts) {
+        if (budget > 0) return std::make_pair(std::min(bytes, budget), budget);
+        return std::make_pair((long long)(1.5 * bytes), 2 * bytes + 2 * bytes / std::max(1, parts));
+    };
+    long long held_budget = 0;
+    if (opts.pipeline_workers > 0) {
+        int workers = opts.pipeline_workers;
+        int queue = opts.queue_batches > 0 ? opts.queue_batches : 2 * workers;
+        double batch_share = std::min(1.0, (double)opts.batch_docs / std::max(1LL, shape.docs));
+        // Batches read ahead, being built, and built but not yet appended
+        double in_flight = std::min(1.0, batch_share * (2 * queue + workers));
+        e.corpus_bytes = (long long)(all_docs * in_flight);
+        long long batch_cws = (long long)(all_cws * batch_share);
+        long long held = (long long)(all_cws * std::min(1.0, batch_share * queue));
+        if (opts.mem_budget > 0) {
+            held_budget = opts.mem_budget / 2;
+            held = std::min(held, held_budget);
+        }
+        e.batch_bytes = held + (long long)(1.5 * std::min(all_cws, workers * batch_cws));
+        e.scratch_bytes *= workers;
+    } else {
+        e.corpus_bytes = all_docs;
+    }
+    auto [cw_expected, cw_worst] = lists(all_cws, opts.mem_budget - held_budget, k);
+    e.cw_bytes = opts.mem_budget > 0 ? cw_worst : all_cws;
+    if (opts.mem_budget > 0 && all_cws > opts.mem_budget - held_budget) {
+        e.spill_bytes = (long long)((e.cws - (double)(opts.mem_budget - held_budget) / cw_size) * record_bytes);
+    }
+
+    long long fixed = e.corpus_bytes + e.batch_bytes + e.idf_bytes + e.vocab_bytes + e.scratch_bytes;
+    e.peak_bytes = fixed + cw_expected;
+    e.peak_worst = fixed + cw_worst;
+    return e;
+}
+
+inline void printEstimate(std::ostream &os, const CorpusShape &shape, const IndexEstimate &e) {
+    os << "Corpus: " << shape.docs << " documents, " << shape.tokens << " tokens, max length "
+       << shape.max_length << std::endl;
+    os << "Estimated CWs: " << (long long)e.cws << std::endl;
+    os << "Estimated index file: " << formatBytes(e.index_bytes) << std::endl;
+    os << "Estimated memory:" << std::endl;
+    os << "  corpus: " << formatBytes(e.corpus_bytes) << std::endl;
+    os << "  cws: " << formatBytes(e.cw_bytes) << std::endl;
+    if (e.batch_bytes) os << "  pipeline batches: " << formatBytes(e.batch_bytes) << std::endl;
+    os << "  idf: " << formatBytes(e.idf_bytes) << std::endl;
+    if (e.vocab_bytes) os << "  vocab: " << formatBytes(e.vocab_bytes) << std::endl;
+    os << "  scratch: " << formatBytes(e.scratch_bytes) << std::endl;
+    os << "  peak: " << formatBytes(e.peak_bytes) << " expected, " << formatBytes(e.peak_worst)
+       << " worst case" << std::endl;
+    if (e.spill_bytes) os << "Estimated spill file: " << formatBytes(e.spill_bytes) << std::endl;
+}
@@ -3,12 +3,15 @@
 #include <random>
 #include <vector>
 #include <fstream>
-#include <unordered_set>
 #include <sstream>
 #include <iostream>
 #include <cmath>
 #include <limits>
 #include "tf_strategy.hpp"
+#include "cws_sampler.hpp"
+#include "doc_freq.hpp"
+#include "idf_file.hpp"
+#include "vocab_map.hpp"
 
 using namespace std;
 
@@ -23,9 +26,18 @@ private:
     // IDF support
     std::vector<double> idf;
     bool use_idf;
+    // Token ids are dense ids under vocab (empty = original ids); hashes
+    // are keyed on the original id either way.
+    VocabMap vocab;
     
     // TF strategy
     TFMode tf_mode;
+
+    // CWS variant for DOUBLE weights
+    CWSSampler sampler = CWSSampler::IOFFE;
+
+    // Bits of the stored fingerprint of each CW value; 0 stores the value
+    int fp_bits = 0;
     
     
     // No separate advanced flag; precision derives from (tf_mode, use_idf)
@@ -47,7 +59,18 @@ public:
         // No-op; DOUBLE mode implies CWS hash in eval.
     }
 
+    // Binary files (idf tool) are read in one go and must match tokenNum;
+    // TSV files set the listed tokens and leave the rest at 1. Both are by
+    // original token id, so load them before setVocabMap.
     void loadIDF(const std::string& filepath) {
+        if (!vocab.empty()) {
+            throw std::logic_error("Load IDF files before remapping the vocabulary");
+        }
+        if (isBinaryIDFFile(filepath)) {
+            readIDFBinary(filepath, idf);
+            use_idf = true;
+            return;
+        }
         std::ifstream file(filepath);
         if (!file.is_open()) {
             throw std::runtime_error("Cannot open IDF file: " + filepath);
@@ -76,75 +99,205 @@ public:
     }
 
     void calculateIDF(const std::vector<std::vector<int>>& docs) {
-        std::vector<int> doc_freq(tokenNum, 0);
-        
-        for (const auto& doc : docs) {
-            std::unordered_set<int> unique_tokens(doc.begin(), doc.end());
-            for (int token : unique_tokens) {
-                if (token >= 0 && token < tokenNum) {
-                    doc_freq[token]++;
-                }
-            }
+        struct View { const int *tokens; int length; };
+        DocFrequencies freq = countDocFrequencies(docs.size(), tokenNum, 1, [&](long long i) {
+            return View{docs[i].data(), (int)docs[i].size()};
+        });
+        idf = freq.idf();
+        use_idf = true;
+    }
+
+    // Use dense token ids from map (over tokenNum tokens) from now on,
+    // reordering the IDF table to match.
+    void setVocabMap(const VocabMap &map) {
+        if (map.size() != tokenNum) {
+            throw std::invalid_argument("Vocabulary map covers " + std::to_string(map.size()) +
+                                        " tokens, the hasher " + std::to_string(tokenNum));
         }
-        
-        for (int i = 0; i < tokenNum; i++) {
-            if (doc_freq[i] > 0) {
-                idf[i] = std::log(static_cast<double>(docs.size()) / doc_freq[i]);
-            } else {
-                idf[i] = 0.0;
-            }
+        if (!vocab.empty()) {
+            throw std::logic_error("Vocabulary is already remapped");
         }
-        use_idf = true;
+        idf = map.permute(idf);
+        vocab = map;
+    }
+
+    const VocabMap &vocabMap() const { return vocab; }
+
+    // The id a token's hashes are keyed on: its original id.
+    int hashId(int token) const { return vocab.empty() ? token : vocab.orig(token); }
+
+    // Random samples of one (hid, token) pair for CWS; they do not depend on
+    // the weight, so a token's occurrences can share them. e caches exp(r).
+    struct CWSSample {
+        double r, c, beta, e;
+    };
+
+    CWSSample cwsSample(int hid, int token) const {
+        token = hashId(token);
+        CWSSample s;
+        if (sampler == CWSSampler::IOFFE) {
+            // Deterministic RNG seeded by global seed_ and (hid, token)
+            uint64_t seed = seed_ ^ ((static_cast<uint64_t>(hid) << 32) ^ static_cast<uint64_t>(token));
+            std::mt19937_64 eng(seed);
+            std::gamma_distribution<double> gamma(2.0, 1.0);      // shape k=2, scale theta=1
+            std::uniform_real_distribution<double> uni(0.0, 1.0); // [0,1)
+
+            s.r = gamma(eng);
+            s.c = gamma(eng);
+            s.beta = uni(eng);
+            if (s.r <= 0.0) s.r = std::numeric_limits<double>::min();
+            if (s.beta <= 0.0) s.beta = std::numeric_limits<double>::min();
+            if (s.beta >= 1.0) s.beta = std::nextafter(1.0, 0.0);
+        } else {
+            uint64_t key = CounterRNG::key(seed_, hid, token);
+            s.r = CounterRNG::gamma2(key, 0);
+            s.c = CounterRNG::gamma2(key, 2);
+            s.beta = CounterRNG::uniform(key, 4);
+        }
+        s.e = std::exp(s.r);
+        return s;
+    }
+
+    static double cwsValue(const CWSSample &s, double w) {
+        if (w <= 0.0) return std::numeric_limits<double>::infinity();
+        double logw = std::log(w);
+        double t = std::floor(logw / s.r + s.beta);
+        double y = std::exp(s.r * (t - s.beta));
+        return s.c / (y * s.e);
     }
 
     // Consistent Weighted Sampling (Ioffe, 2010) using C++ standard distributions
     inline double cws_hash(int hid, int token, double w) {
         if (w <= 0.0) return std::numeric_limits<double>::infinity();
-        // Deterministic RNG seeded by global seed_ and (hid, token)
-        uint64_t seed = seed_ ^ ((static_cast<uint64_t>(hid) << 32) ^ static_cast<uint64_t>(token));
-        std::mt19937_64 eng(seed);
-        std::gamma_distribution<double> gamma(2.0, 1.0);      // shape k=2, scale theta=1
-        std::uniform_real_distribution<double> uni(0.0, 1.0); // [0,1)
-
-        double r = gamma(eng);
-        double c = gamma(eng);
-        double beta = uni(eng);
-        if (r <= 0.0) r = std::numeric_limits<double>::min();
-        if (beta <= 0.0) beta = std::numeric_limits<double>::min();
-        if (beta >= 1.0) beta = std::nextafter(1.0, 0.0);
+        return cwsValue(cwsSample(hid, token), w);
+    }
 
-        double logw = std::log(w);
-        double t = std::floor(logw / r + beta);
-        double y = std::exp(r * (t - beta));
-        return c / (y * std::exp(r));
+    // Linear hash coefficients (a,b,c) of hash function hid, derived
+    // deterministically from seed_ and hid.
+    void linearCoefficients(int hid, int &a, int &b, int &c) const {
+        std::mt19937 eng(static_cast<uint32_t>(seed_ ^ static_cast<uint64_t>(hid)));
+        std::uniform_int_distribution<int> distA(1, p - 1);
+        std::uniform_int_distribution<int> distB(1, p - 1);
+        std::uniform_int_distribution<int> distC(0, p - 1);
+        a = distA(eng);
+        b = distB(eng);
+        c = distC(eng);
     }
 
     WeightType eval(int hid, int token, WeightType weight) {
         if constexpr (std::is_same_v<WeightType, int>) {
-            // Derive linear hash coefficients (a,b,c) deterministically from seed_ and hid
-            std::mt19937 eng(static_cast<uint32_t>(seed_ ^ static_cast<uint64_t>(hid)));
-            std::uniform_int_distribution<int> distA(1, p - 1);
-            std::uniform_int_distribution<int> distB(1, p - 1);
-            std::uniform_int_distribution<int> distC(0, p - 1);
-            int a = distA(eng), b = distB(eng), c = distC(eng);
-            return ( (1LL * token * a + 1LL * weight * b + c) % p );
+            int a, b, c;
+            linearCoefficients(hid, a, b, c);
+            return ( (1LL * hashId(token) * a + 1LL * weight * b + c) % p );
         } else {
             double final_weight = use_idf ? (static_cast<double>(weight) * idf[token]) : static_cast<double>(weight);
             return cws_hash(hid, token, final_weight);
         }
     }
 
+    // eval() for a weight that already includes IDF (see DocWeights).
+    WeightType evalWeighted(int hid, int token, WeightType w) const {
+        if constexpr (std::is_same_v<WeightType, int>) {
+            int a, b, c;
+            linearCoefficients(hid, a, b, c);
+            return ( (1LL * hashId(token) * a + 1LL * w * b + c) % p );
+        } else {
+            return cwsValue(cwsSample(hid, token), w);
+        }
+    }
+
+    // evalWeighted(hid, token, w[i]) for i < n, written to out; DOUBLE draws
+    // the token's CWS samples once for the whole run.
+    void evalRun(int hid, int token, const WeightType *w, int n, WeightType *out) const {
+        if constexpr (std::is_same_v<WeightType, int>) {
+            int a, b, c;
+            linearCoefficients(hid, a, b, c);
+            long long key = 1LL * hashId(token) * a;
+            for (int i = 0; i < n; i++) {
+                out[i] = (key + 1LL * w[i] * b + c) % p;
+            }
+        } else {
+            CWSSample s = cwsSample(hid, token);
+            for (int i = 0; i < n; i++) {
+                out[i] = cwsValue(s, w[i]);
+            }
+        }
+    }
+
+    // eval(hid, tokens[i], weights[i]) for i < n, written to out. Per-hash
+    // setup runs once per call: INT hoists the linear coefficients out of the
+    // loop, DOUBLE draws the CWS samples once per run of equal tokens, so
+    // callers should pass a token's occurrences next to each other.
+    void evalBatch(int hid, const int *tokens, const WeightType *weights, int n, WeightType *out) const {
+        if constexpr (std::is_same_v<WeightType, int>) {
+            int a, b, c;
+            linearCoefficients(hid, a, b, c);
+            for (int i = 0; i < n; i++) {
+                out[i] = (1LL * hashId(tokens[i]) * a + 1LL * weights[i] * b + c) % p;
+            }
+        } else {
+            CWSSample s{};
+            int last = -1;
+            for (int i = 0; i < n; i++) {
+                int token = tokens[i];
+                double w = use_idf ? (static_cast<double>(weights[i]) * idf[token]) : static_cast<double>(weights[i]);
+                if (w <= 0.0) {
+                    out[i] = std::numeric_limits<double>::infinity();
+                    continue;
+                }
+                if (token != last) {
+                    s = cwsSample(hid, token);
+                    last = token;
+                }
+                out[i] = cwsValue(s, w);
+            }
+        }
+    }
+
     // No explicit HF stored; coefficients are derived from seed_ on the fly.
 
+    int getK() const { return k; }
+    int getTokenNum() const { return tokenNum; }
     bool isIDFEnabled() const { return use_idf; }
+    double idfOf(int token) const { return idf[token]; }
+    long long idfBytes() const { return (long long)idf.capacity() * sizeof(double); }
+    long long vocabBytes() const { return vocab.bytes(); }
     
     void setTFMode(TFMode mode) { tf_mode = mode; }
     TFMode getTFMode() const { return tf_mode; }
+
+    void setSampler(CWSSampler s) {
+        if constexpr (std::is_same_v<WeightType, int>) {
+            if (s != CWSSampler::IOFFE) {
+                throw std::invalid_argument("CWS samplers only apply to DOUBLE weights (non-raw TF or IDF)");
+            }
+        }
+        sampler = s;
+    }
+    CWSSampler getSampler() const { return sampler; }
+
+    // Store a 32- or 16-bit fingerprint of each DOUBLE CW value instead of
+    // the value (0 = full values).
+    void setFingerprintBits(int bits) {
+        if (bits != 0 && bits != 16 && bits != 32) {
+            throw std::invalid_argument("Fingerprint bits must be 0, 16 or 32");
+        }
+        if constexpr (std::is_same_v<WeightType, int>) {
+            if (bits != 0) {
+                throw std::invalid_argument("Fingerprints only apply to DOUBLE weights (non-raw TF or IDF)");
+            }
+        }
+        fp_bits = bits;
+    }
+    int fingerprintBits() const { return fp_bits; }
     
     std::string getModeInfo() const {
         std::string info = "Hasher Mode: ";
         if constexpr (std::is_same_v<WeightType, int>) info += "INT_OPTIMIZED"; else info += "DOUBLE_PRECISION_CWS";
         info += "\nIDF Enabled: " + std::string(use_idf ? "Yes" : "No");
+        if constexpr (std::is_same_v<WeightType, double>) info += "\nCWS Sampler: " + std::string(cwsSamplerName(sampler));
+        if (fp_bits) info += "\nFingerprints: " + std::to_string(fp_bits) + "-bit";
+        if (!vocab.empty()) info += "\nVocabulary: remapped, " + std::to_string(vocab.usedTokens()) + " tokens used";
         
         info += "\nTF Strategy: ";
         switch (tf_mode) {
@@ -159,12 +312,18 @@ public:
         return info;
     }
 
-    void saveToFile(std::ofstream& file) const {
+    void saveToFile(std::ostream& file) const {
         // Save basic parameters
         file.write(reinterpret_cast<const char*>(&k), sizeof(k));
         file.write(reinterpret_cast<const char*>(&tokenNum), sizeof(tokenNum));
         file.write(reinterpret_cast<const char*>(&use_idf), sizeof(use_idf));
-        file.write(reinterpret_cast<const char*>(&tf_mode), sizeof(tf_mode));
+        // The sampler (bits 8-15), fingerprint width (bits 16-23) and
+        // vocabulary map flag (bit 24) share the TF mode's word; indexes from
+        // before they existed have zero there, which reads as IOFFE with full
+        // values and original token ids.
+        int32_t mode_word = static_cast<int32_t>(tf_mode) | (static_cast<int32_t>(sampler) << 8) | (fp_bits << 16) |
+                            ((vocab.empty() ? 0 : 1) << 24);
+        file.write(reinterpret_cast<const char*>(&mode_word), sizeof(mode_word));
         file.write(reinterpret_cast<const char*>(&seed_), sizeof(seed_));
         
         // Save IDF data if enabled
@@ -173,14 +332,47 @@ public:
                 file.write(reinterpret_cast<const char*>(&val), sizeof(val));
             }
         }
+        if (!vocab.empty()) {
+            vocab.save(file);
+        }
+    }
+
+    // What CW values depend on: saveToFile's fields without the vocabulary
+    // map, the IDF table in original token order. Indexes of one corpus
+    // remapped differently (sharded --remap-vocab builds) compare equal.
+    void saveHashConfig(std::ostream& file) const {
+        file.write(reinterpret_cast<const char*>(&k), sizeof(k));
+        file.write(reinterpret_cast<const char*>(&tokenNum), sizeof(tokenNum));
+        file.write(reinterpret_cast<const char*>(&use_idf), sizeof(use_idf));
+        int32_t mode_word = static_cast<int32_t>(tf_mode) | (static_cast<int32_t>(sampler) << 8) | (fp_bits << 16);
+        file.write(reinterpret_cast<const char*>(&mode_word), sizeof(mode_word));
+        file.write(reinterpret_cast<const char*>(&seed_), sizeof(seed_));
+        if (use_idf) {
+            for (int t = 0; t < tokenNum; t++) {
+                double val = idf[vocab.empty() ? t : vocab.dense(t)];
+                file.write(reinterpret_cast<const char*>(&val), sizeof(val));
+            }
+        }
     }
 
-    void loadFromFile(std::ifstream& file) {
+    void loadFromFile(std::istream& file) {
         // Load basic parameters
         file.read(reinterpret_cast<char*>(&k), sizeof(k));
         file.read(reinterpret_cast<char*>(&tokenNum), sizeof(tokenNum));
         file.read(reinterpret_cast<char*>(&use_idf), sizeof(use_idf));
-        file.read(reinterpret_cast<char*>(&tf_mode), sizeof(tf_mode));
+        int32_t mode_word = 0;
+        file.read(reinterpret_cast<char*>(&mode_word), sizeof(mode_word));
+        tf_mode = static_cast<TFMode>(mode_word & 0xff);
+        int sampler_id = (mode_word >> 8) & 0xff;
+        if (sampler_id > static_cast<int>(CWSSampler::ICWS)) {
+            throw std::runtime_error("Index uses an unknown CWS sampler (" + std::to_string(sampler_id) + ")");
+        }
+        sampler = static_cast<CWSSampler>(sampler_id);
+        fp_bits = (mode_word >> 16) & 0xff;
+        if (fp_bits != 0 && fp_bits != 16 && fp_bits != 32) {
+            throw std::runtime_error("Index uses an unknown fingerprint width (" + std::to_string(fp_bits) + ")");
+        }
+        bool remapped = (mode_word >> 24) & 1;
         file.read(reinterpret_cast<char*>(&seed_), sizeof(seed_));
         
         // Resize vectors
@@ -194,5 +386,9 @@ public:
                 file.read(reinterpret_cast<char*>(&val), sizeof(val));
             }
         }
+        vocab = VocabMap();
+        if (remapped) {
+            vocab.load(file, tokenNum);
+        }
     }
 };
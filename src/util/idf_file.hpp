@@ -0,0 +1,101 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iomanip>
+#include <cstdint>
+#include <stdexcept>
+#include "checksum.hpp"
+
+// Binary IDF file, as written by the idf tool:
+//   uint32 magic, uint32 version
+//   uint32 vocabulary size n, uint32 reserved (0)
+//   uint64 number of documents the IDF was computed over
+//   n doubles, the IDF of tokens 0..n-1
+//   uint64 checksum of the doubles
+// The table is read with one read straight into the Hasher's IDF vector.
+// TSV IDF files (token<TAB>idf per line) start with a digit, never with
+// the magic, so Hasher::loadIDF tells the two apart by the first word.
+const uint32_t kIDFMagic = 0x4644494f;   // "OIDF" in file byte order
+const uint32_t kIDFVersion = 1;
+
+struct IDFFileHeader {
+    uint32_t magic = kIDFMagic;
+    uint32_t version = kIDFVersion;
+    uint32_t tokens = 0;
+    uint32_t reserved = 0;
+    uint64_t num_docs = 0;
+};
+
+inline bool isBinaryIDFFile(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    uint32_t magic = 0;
+    return file.read(reinterpret_cast<char*>(&magic), sizeof(magic)) && magic == kIDFMagic;
+}
+
+inline void writeIDFBinary(const std::string &path, const std::vector<double> &idf, uint64_t num_docs) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot open file for writing: " + path);
+    }
+    IDFFileHeader h;
+    h.tokens = (uint32_t)idf.size();
+    h.num_docs = num_docs;
+    Checksum sum;
+    sum.update(idf.data(), idf.size() * sizeof(double));
+    uint64_t value = sum.value();
+    file.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    file.write(reinterpret_cast<const char*>(idf.data()), idf.size() * sizeof(double));
+    file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    if (!file) {
+        throw std::runtime_error("Failed writing IDF file: " + path);
+    }
+}
+
+// Token<TAB>idf for every token of the vocabulary, readable by the TSV path
+// of Hasher::loadIDF and by other tools. Tokens that never occur are listed
+// with 0, as the loader would otherwise leave them at 1.
+inline void writeIDFText(const std::string &path, const std::vector<double> &idf) {
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot open file for writing: " + path);
+    }
+    file << std::setprecision(17);
+    for (size_t t = 0; t < idf.size(); t++) {
+        file << t << '\t' << idf[t] << '\n';
+    }
+    if (!file) {
+        throw std::runtime_error("Failed writing IDF file: " + path);
+    }
+}
+
+// Read a binary IDF file into idf, which must be sized to the vocabulary;
+// a file for a different vocabulary size is rejected.
+inline IDFFileHeader readIDFBinary(const std::string &path, std::vector<double> &idf) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot open IDF file: " + path);
+    }
+    IDFFileHeader h;
+    if (!file.read(reinterpret_cast<char*>(&h), sizeof(h)) || h.magic != kIDFMagic) {
+        throw std::runtime_error("Not a binary IDF file: " + path);
+    }
+    if (h.version != kIDFVersion) {
+        throw std::runtime_error("Unsupported IDF file version " + std::to_string(h.version) + ": " + path);
+    }
+    if (h.tokens != idf.size()) {
+        throw std::runtime_error("IDF file covers " + std::to_string(h.tokens) + " tokens but the vocabulary has " +
+                                 std::to_string(idf.size()) + " (-v): " + path);
+    }
+    uint64_t value = 0;
+    if (!file.read(reinterpret_cast<char*>(idf.data()), idf.size() * sizeof(double)) ||
+        !file.read(reinterpret_cast<char*>(&value), sizeof(value))) {
+        throw std::runtime_error("IDF file truncated: " + path);
+    }
+    Checksum sum;
+    sum.update(idf.data(), idf.size() * sizeof(double));
+    if (sum.value() != value) {
+        throw std::runtime_error("IDF file fails its checksum: " + path);
+    }
+    return h;
+}
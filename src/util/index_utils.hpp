@@ -1,7 +1,179 @@
 #pragma once
 #include <fstream>
+#include <sstream>
 #include <string>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
 #include "tf_strategy.hpp"
+#include "cws_sampler.hpp"
+#include "checksum.hpp"
+#include "cw_columns.hpp"
+#include "hasher.hpp"
+
+// Index file layout, version 3 (written by AbstractBuilder::saveIndex):
+//   uint32 magic, uint32 version
+//   hasher configuration (Hasher::saveToFile: k, tokenNum, use_idf, mode
+//   word, seed, IDF table, vocabulary map if remapped)
+//   uint64 number of indexed documents
+//   uint64 chunk length of build -l, 0 if the documents are the corpus's
+//   k block entries: uint64 offset, uint64 CW count, uint64 checksum
+//   uint64 checksum of all bytes above
+//   the k blocks of CW records, at their offsets
+// Each block carries its own checksum, so one hash function's CWs can be
+// read and verified without touching the others. Version 2 is the same
+// without the chunk length.
+//
+// Version 1 files (no magic) hold int k, int tokenNum, the hasher
+// configuration, then per hash function a size_t count and its records.
+// Their first word is k, which never reaches the magic's value.
+const uint32_t kIndexMagic = 0x5849414f;   // "OAIX" in file byte order
+const uint32_t kIndexVersion = 3;
+
+struct IndexBlock {
+    uint64_t offset = 0;     // of the first record, from the start of the file
+    uint64_t count = 0;
+    uint64_t checksum = 0;   // of the records; unused in version 1
+};
+
+// Where each hash function's CWs are in an index file.
+struct IndexLayout {
+    uint32_t version = 1;
+    uint64_t num_docs = 0;   // 0 = not recorded (version 1)
+    uint64_t chunk_length = 0;   // documents are -l chunks of this length; 0 = corpus documents
+    std::vector<IndexBlock> blocks;
+
+    void verifyBlock(int hid, const Checksum &sum, const std::string &filename) const {
+        if (version >= 2 && sum.value() != blocks[hid].checksum) {
+            throw std::runtime_error("Index block " + std::to_string(hid) + " fails its checksum: " + filename);
+        }
+    }
+};
+
+// Magic through block table, followed by their checksum.
+template<typename WeightType>
+void writeIndexHeader(std::ostream &out, const Hasher<WeightType> &hasher, uint64_t num_docs,
+                      uint64_t chunk_length, const std::vector<IndexBlock> &blocks) {
+    std::ostringstream header;
+    header.write(reinterpret_cast<const char*>(&kIndexMagic), sizeof(kIndexMagic));
+    header.write(reinterpret_cast<const char*>(&kIndexVersion), sizeof(kIndexVersion));
+    hasher.saveToFile(header);
+    header.write(reinterpret_cast<const char*>(&num_docs), sizeof(num_docs));
+    header.write(reinterpret_cast<const char*>(&chunk_length), sizeof(chunk_length));
+    for (const IndexBlock &b : blocks) {
+        header.write(reinterpret_cast<const char*>(&b.offset), sizeof(b.offset));
+        header.write(reinterpret_cast<const char*>(&b.count), sizeof(b.count));
+        header.write(reinterpret_cast<const char*>(&b.checksum), sizeof(b.checksum));
+    }
+    std::string bytes = header.str();
+    Checksum sum;
+    sum.update(bytes.data(), bytes.size());
+    uint64_t value = sum.value();
+    out.write(bytes.data(), bytes.size());
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Write a complete version 2 index file. count(hid) is the number of CWs of
+// hash function hid and writeBlock(hid, out, sum) writes exactly those
+// records (CWColumns::writeRecords or writeFingerprintRecords) feeding sum.
+// Block offsets follow from the counts; the checksums are filled in once the
+// blocks are written, over the same-sized header. chunk_length as in
+// IndexLayout.
+template<typename WeightType, typename CountFn, typename BlockFn>
+void writeIndexFile(const std::string &filename, const Hasher<WeightType> &hasher, uint64_t num_docs,
+                    uint64_t chunk_length, CountFn count, BlockFn writeBlock) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot open file for writing: " + filename);
+    }
+    int k = hasher.getK();
+    size_t record_bytes = CWColumns<WeightType>::recordBytes(hasher.fingerprintBits());
+    std::vector<IndexBlock> blocks(k);
+    std::ostringstream sizing;
+    writeIndexHeader(sizing, hasher, num_docs, chunk_length, blocks);
+    uint64_t offset = sizing.str().size();
+    for (int hid = 0; hid < k; hid++) {
+        blocks[hid].offset = offset;
+        blocks[hid].count = count(hid);
+        offset += blocks[hid].count * record_bytes;
+    }
+    writeIndexHeader(file, hasher, num_docs, chunk_length, blocks);
+
+    for (int hid = 0; hid < k; hid++) {
+        Checksum sum;
+        writeBlock(hid, file, sum);
+        blocks[hid].checksum = sum.value();
+    }
+
+    file.seekp(0);
+    writeIndexHeader(file, hasher, num_docs, chunk_length, blocks);
+    file.close();
+    if (!file) {
+        throw std::runtime_error("Failed writing index file: " + filename);
+    }
+}
+
+// Load the hasher configuration of either version and locate the CW blocks,
+// without reading them. Version 1 blocks are found by seeking past each.
+template<typename WeightType>
+IndexLayout readIndexLayout(std::ifstream &file, Hasher<WeightType> &hasher, const std::string &filename) {
+    IndexLayout layout;
+    uint32_t magic = 0;
+    if (!file.read(reinterpret_cast<char*>(&magic), sizeof(magic))) {
+        throw std::runtime_error("Index file is empty: " + filename);
+    }
+
+    if (magic != kIndexMagic) {
+        int k, tokenNum;
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(&k), sizeof(k));
+        file.read(reinterpret_cast<char*>(&tokenNum), sizeof(tokenNum));
+        hasher.loadFromFile(file);
+        size_t record_bytes = CWColumns<WeightType>::recordBytes(hasher.fingerprintBits());
+        layout.blocks.resize(k);
+        for (IndexBlock &b : layout.blocks) {
+            size_t cw_count = 0;
+            if (!file.read(reinterpret_cast<char*>(&cw_count), sizeof(cw_count))) {
+                throw std::runtime_error("Index file truncated in its block list: " + filename);
+            }
+            b.offset = file.tellg();
+            b.count = cw_count;
+            file.seekg(cw_count * record_bytes, std::ios::cur);
+        }
+        return layout;
+    }
+
+    file.read(reinterpret_cast<char*>(&layout.version), sizeof(layout.version));
+    if (layout.version < 2 || layout.version > kIndexVersion) {
+        throw std::runtime_error("Unsupported index version " + std::to_string(layout.version) + ": " + filename);
+    }
+    hasher.loadFromFile(file);
+    file.read(reinterpret_cast<char*>(&layout.num_docs), sizeof(layout.num_docs));
+    if (layout.version >= 3) {
+        file.read(reinterpret_cast<char*>(&layout.chunk_length), sizeof(layout.chunk_length));
+    }
+    layout.blocks.resize(hasher.getK());
+    for (IndexBlock &b : layout.blocks) {
+        file.read(reinterpret_cast<char*>(&b.offset), sizeof(b.offset));
+        file.read(reinterpret_cast<char*>(&b.count), sizeof(b.count));
+        file.read(reinterpret_cast<char*>(&b.checksum), sizeof(b.checksum));
+    }
+    size_t header_bytes = file.tellg();
+    uint64_t stored = 0;
+    if (!file.read(reinterpret_cast<char*>(&stored), sizeof(stored))) {
+        throw std::runtime_error("Index file truncated in its header: " + filename);
+    }
+
+    std::vector<char> bytes(header_bytes);
+    file.seekg(0);
+    file.read(bytes.data(), header_bytes);
+    Checksum sum;
+    sum.update(bytes.data(), bytes.size());
+    if (sum.value() != stored) {
+        throw std::runtime_error("Index header fails its checksum: " + filename);
+    }
+    return layout;
+}
 
 // Index file header information structure
 struct IndexHeader {
@@ -9,11 +181,17 @@ struct IndexHeader {
     int tokenNum;
     bool use_idf;
     TFMode tf_mode;
+    CWSSampler sampler;
+    int fingerprint_bits;   // 0 = full CW values
+    int vocab_used;         // tokens of a remapped vocabulary; -1 = not remapped
+    uint32_t version;
+    uint64_t num_docs;      // 0 = not recorded
+    uint64_t chunk_length;  // build -l chunk length; 0 = corpus documents
     // Infer WeightType: Raw TF + no IDF = INT, otherwise DOUBLE
     bool isIntType() const {
         return (tf_mode == TFMode::RAW) && (!use_idf);
     }
-    
+
     bool isDoubleType() const {
         return !isIntType();
     }
@@ -25,19 +203,54 @@ inline IndexHeader readIndexHeader(const std::string& filename) {
     if (!file.is_open()) {
         throw std::runtime_error("Cannot open file for reading: " + filename);
     }
-    
+
     IndexHeader header;
-    
-    // Read basic parameters
+    header.version = 1;
+    header.num_docs = 0;
+    header.chunk_length = 0;
+
+    uint32_t magic = 0;
+    file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    if (magic == kIndexMagic) {
+        file.read(reinterpret_cast<char*>(&header.version), sizeof(header.version));
+    } else {
+        // Version 1 repeats k and tokenNum ahead of the hasher configuration
+        file.seekg(2 * sizeof(int));
+    }
+
+    // Read hasher configuration (order must match hasher.hpp::loadFromFile)
     file.read(reinterpret_cast<char*>(&header.k), sizeof(header.k));
     file.read(reinterpret_cast<char*>(&header.tokenNum), sizeof(header.tokenNum));
-    
-    // Read hasher configuration (order must match hasher.hpp::loadFromFile)
-    file.read(reinterpret_cast<char*>(&header.k), sizeof(header.k)); // hasher internal k
-    file.read(reinterpret_cast<char*>(&header.tokenNum), sizeof(header.tokenNum)); // hasher internal tokenNum
     file.read(reinterpret_cast<char*>(&header.use_idf), sizeof(header.use_idf));
-    file.read(reinterpret_cast<char*>(&header.tf_mode), sizeof(header.tf_mode));
-    
+    // TF mode in bits 0-7, CWS sampler in bits 8-15, fingerprint width in
+    // bits 16-23, vocabulary map flag in bit 24 (see Hasher::saveToFile)
+    int32_t mode_word = 0;
+    file.read(reinterpret_cast<char*>(&mode_word), sizeof(mode_word));
+    header.tf_mode = static_cast<TFMode>(mode_word & 0xff);
+    header.sampler = static_cast<CWSSampler>((mode_word >> 8) & 0xff);
+    header.fingerprint_bits = (mode_word >> 16) & 0xff;
+    header.vocab_used = -1;
+
+    if (header.version >= 2) {
+        // Skip the seed and IDF table
+        file.seekg(sizeof(uint64_t) + (header.use_idf ? (long long)header.tokenNum * sizeof(double) : 0),
+                   std::ios::cur);
+        if ((mode_word >> 24) & 1) {
+            // Skip the vocabulary map (VocabMap::save)
+            uint32_t used = 0;
+            file.read(reinterpret_cast<char*>(&used), sizeof(used));
+            header.vocab_used = (int)used;
+            file.seekg((long long)used * sizeof(int), std::ios::cur);
+        }
+        file.read(reinterpret_cast<char*>(&header.num_docs), sizeof(header.num_docs));
+        if (header.version >= 3) {
+            file.read(reinterpret_cast<char*>(&header.chunk_length), sizeof(header.chunk_length));
+        }
+    }
+    if (!file) {
+        throw std::runtime_error("Index file truncated in its header: " + filename);
+    }
+
     file.close();
     return header;
 }
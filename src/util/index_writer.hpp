@@ -0,0 +1,78 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <memory>
+#include "cw.hpp"
+#include "cw_columns.hpp"
+#include "cw_spill.hpp"
+#include "hasher.hpp"
+#include "index_utils.hpp"
+#include "memory.hpp"
+
+// Accumulates CWs per hash function from batches of documents appended in
+// document order, then writes them as an index file. Used by the pipelined
+// build, where builders hand over each batch's CWs as they finish. Under a
+// memory budget, full lists are spilled to a temporary file and copied back
+// into the index by write.
+template<typename WeightType>
+class IndexWriter {
+private:
+    std::vector<std::vector<CW<WeightType>>> blocks;
+    uint64_t num_docs = 0;
+    std::unique_ptr<CWSpill<WeightType>> spill;
+
+public:
+    explicit IndexWriter(int k) : blocks(k) {}
+
+    void setMemoryBudget(long long budget_bytes, const std::string &spill_dir) {
+        spill = std::make_unique<CWSpill<WeightType>>((int)blocks.size(), budget_bytes, spill_dir);
+        for (auto &b : blocks) spill->reserve(b);
+    }
+    const CWSpill<WeightType> *getSpill() const { return spill.get(); }
+
+    // The CWs of the next num_batch_docs documents, per hash function, with
+    // T already global.
+    void append(const std::vector<std::vector<CW<WeightType>>> &batch, int num_batch_docs) {
+        for (size_t hid = 0; hid < blocks.size(); hid++) {
+            if (spill) {
+                spill->append((int)hid, blocks[hid], batch[hid]);
+            } else {
+                blocks[hid].insert(blocks[hid].end(), batch[hid].begin(), batch[hid].end());
+            }
+        }
+        num_docs += num_batch_docs;
+    }
+
+    uint64_t numDocs() const { return num_docs; }
+
+    long long size() const {
+        long long sum = spill ? spill->spilledCWs() : 0;
+        for (const auto &b : blocks) sum += b.size();
+        return sum;
+    }
+
+    void write(const std::string &filename, const Hasher<WeightType> &hasher) const {
+        int fp_bits = hasher.fingerprintBits();
+        writeIndexFile(filename, hasher, num_docs, 0,
+                       [&](int hid) { return blocks[hid].size() + (spill ? spill->spilledCWs(hid) : 0); },
+                       [&](int hid, std::ofstream &out, Checksum &sum) {
+            if (spill) {
+                spill->copyBlock(hid, blocks[hid], out, sum, fp_bits);
+            } else if (fp_bits) {
+                CWColumns<WeightType>::writeFingerprintRecords(out, blocks[hid].data(), blocks[hid].size(), fp_bits,
+                                                               &sum);
+            } else {
+                CWColumns<WeightType>::writeRecords(out, blocks[hid].data(), blocks[hid].size(), &sum);
+            }
+        });
+    }
+
+    void reportMemory(MemoryReport &report) const {
+        long long used = 0, reserved = 0;
+        for (const auto &b : blocks) {
+            used += (long long)b.size() * sizeof(CW<WeightType>);
+            reserved += vectorBytes(b);
+        }
+        report.add("cws", used, reserved);
+    }
+};
@@ -0,0 +1,102 @@
+#pragma once
+#include <cmath>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Minimal streaming JSON writer for reports. Callers open and close objects
+// and arrays; separators and string escaping are handled here.
+class JsonWriter {
+private:
+    std::ostream &os;
+    std::vector<bool> empty;   // per open container: nothing written yet
+    bool after_key = false;
+
+    void separate()
+    {
+        if (after_key)
+        {
+            after_key = false;
+            return;
+        }
+        if (!empty.empty())
+        {
+            if (!empty.back()) os << ',';
+            empty.back() = false;
+        }
+    }
+
+    void writeString(const std::string &s)
+    {
+        os << '"';
+        for (char ch : s)
+        {
+            switch (ch)
+            {
+            case '"': os << "\\\""; break;
+            case '\\': os << "\\\\"; break;
+            case '\n': os << "\\n"; break;
+            case '\t': os << "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(ch) < 0x20)
+                {
+                    char buf[8];
+                    std::snprintf(buf, sizeof(buf), "\\u%04x", ch);
+                    os << buf;
+                }
+                else
+                {
+                    os << ch;
+                }
+            }
+        }
+        os << '"';
+    }
+
+public:
+    explicit JsonWriter(std::ostream &os_) : os(os_) {}
+
+    JsonWriter &beginObject() { separate(); os << '{'; empty.push_back(true); return *this; }
+    JsonWriter &endObject() { empty.pop_back(); os << '}'; return *this; }
+    JsonWriter &beginArray() { separate(); os << '['; empty.push_back(true); return *this; }
+    JsonWriter &endArray() { empty.pop_back(); os << ']'; return *this; }
+
+    JsonWriter &key(const std::string &k)
+    {
+        separate();
+        writeString(k);
+        os << ':';
+        after_key = true;
+        return *this;
+    }
+
+    JsonWriter &value(const std::string &v) { separate(); writeString(v); return *this; }
+    JsonWriter &value(const char *v) { return value(std::string(v)); }
+    JsonWriter &value(bool v) { separate(); os << (v ? "true" : "false"); return *this; }
+    JsonWriter &value(int v) { separate(); os << v; return *this; }
+    JsonWriter &value(long v) { separate(); os << v; return *this; }
+    JsonWriter &value(long long v) { separate(); os << v; return *this; }
+    JsonWriter &value(unsigned long v) { separate(); os << v; return *this; }
+    JsonWriter &value(unsigned long long v) { separate(); os << v; return *this; }
+    JsonWriter &value(double v)
+    {
+        separate();
+        if (!std::isfinite(v))
+        {
+            os << "null";
+            return *this;
+        }
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%.9g", v);
+        os << buf;
+        return *this;
+    }
+
+    template<typename T>
+    JsonWriter &field(const std::string &k, const T &v)
+    {
+        key(k);
+        return value(v);
+    }
+};
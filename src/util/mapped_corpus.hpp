@@ -0,0 +1,193 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <stdexcept>
+#include <cstddef>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "checksum.hpp"
+
+// Document offset sidecar of a corpus, <corpus>.offsets, as written by build:
+//   uint32 magic, uint32 version
+//   uint64 corpus size in bytes, int64 corpus mtime seconds, int64 nanoseconds
+//   uint64 number of documents n
+//   n uint64 word offsets of the documents' length prefixes
+//   uint64 checksum of the offsets
+// A sidecar whose size or mtime no longer match the corpus is ignored.
+const uint32_t kOffsetsMagic = 0x53464f4f;   // "OOFS" in file byte order
+const uint32_t kOffsetsVersion = 1;
+
+struct OffsetsFileHeader {
+    uint32_t magic = kOffsetsMagic;
+    uint32_t version = kOffsetsVersion;
+    uint64_t corpus_bytes = 0;
+    int64_t mtime_sec = 0;
+    int64_t mtime_nsec = 0;
+    uint64_t docs = 0;
+};
+
+// Read-only view of a .bin corpus (per document an int length, then that many
+// int tokens) through mmap. Document offsets come from the corpus's offsets
+// sidecar when it has a current one. Otherwise, and past the documents the
+// sidecar covers, they are located on first use by hopping over the length
+// prefixes: reaching document i then touches one prefix per earlier document,
+// once, so the first access deep into a large corpus reads a page per few
+// earlier documents.
+class MappedCorpus {
+private:
+    std::string path;
+    const int *data = nullptr;
+    size_t words = 0;                 // file size in ints
+    std::vector<size_t> starts;       // word offset of each located document's length
+    OffsetsFileHeader stamp;          // size and mtime of the mapped file
+    bool from_sidecar = false;
+
+    // Adopt a current sidecar's offsets; any problem leaves starts empty.
+    void loadOffsets() {
+        std::ifstream file(offsetsPath(), std::ios::binary);
+        OffsetsFileHeader h;
+        if (!file.read(reinterpret_cast<char*>(&h), sizeof(h)) || h.magic != kOffsetsMagic ||
+            h.version != kOffsetsVersion || h.corpus_bytes != stamp.corpus_bytes ||
+            h.mtime_sec != stamp.mtime_sec || h.mtime_nsec != stamp.mtime_nsec || h.docs > words) {
+            return;
+        }
+        std::vector<uint64_t> offsets(h.docs);
+        uint64_t value = 0;
+        if (!file.read(reinterpret_cast<char*>(offsets.data()), offsets.size() * sizeof(uint64_t)) ||
+            !file.read(reinterpret_cast<char*>(&value), sizeof(value))) {
+            return;
+        }
+        Checksum sum;
+        sum.update(offsets.data(), offsets.size() * sizeof(uint64_t));
+        if (sum.value() != value) return;
+        for (size_t i = 0; i < offsets.size(); i++) {
+            if (offsets[i] >= words || (i > 0 && offsets[i] <= offsets[i - 1])) return;
+        }
+        starts.assign(offsets.begin(), offsets.end());
+        from_sidecar = true;
+    }
+
+    // Locate documents up to id; stops early at the end of the file.
+    void locate(int id) {
+        while ((int)starts.size() <= id) {
+            size_t next = starts.empty() ? 0 : starts.back() + 1 + data[starts.back()];
+            if (next >= words) return;
+            int length = data[next];
+            if (length < 0 || next + 1 + (size_t)length > words) {
+                throw std::runtime_error("Corpus file truncated at document " + std::to_string(starts.size()) +
+                                         ": " + path);
+            }
+            starts.push_back(next);
+        }
+    }
+
+public:
+    struct Doc {
+        const int *tokens;
+        int length;
+    };
+
+    explicit MappedCorpus(const std::string &path_) : path(path_) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open corpus file: " + path);
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Cannot stat corpus file: " + path);
+        }
+        words = (size_t)st.st_size / sizeof(int);
+        if (words > 0) {
+            void *p = mmap(nullptr, words * sizeof(int), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("Cannot map corpus file: " + path);
+            }
+            data = static_cast<const int *>(p);
+        }
+        ::close(fd);
+        stamp.corpus_bytes = (uint64_t)st.st_size;
+        stamp.mtime_sec = (int64_t)st.st_mtim.tv_sec;
+        stamp.mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+        loadOffsets();
+    }
+
+    ~MappedCorpus() {
+        if (data) munmap(const_cast<int *>(data), words * sizeof(int));
+    }
+
+    MappedCorpus(const MappedCorpus &) = delete;
+    MappedCorpus &operator=(const MappedCorpus &) = delete;
+
+    const std::string &filename() const { return path; }
+    std::string offsetsPath() const { return path + ".offsets"; }
+
+    // Whether the offsets of located documents came from the sidecar.
+    bool hasSidecar() const { return from_sidecar; }
+
+    bool hasDoc(int id) {
+        if (id < 0) return false;
+        locate(id);
+        return id < (int)starts.size();
+    }
+
+    // Locate every document (up to limit, if positive) and return how many
+    // there are. Afterwards doc() on them no longer modifies the offset
+    // table, so threads may share the corpus.
+    int locateAll(int limit = 0) {
+        int n = 0;
+        while ((limit <= 0 || n < limit) && hasDoc(n)) n++;
+        return n;
+    }
+
+    // Write the offsets of the documents located so far to the sidecar,
+    // through a temporary file renamed over it.
+    void writeOffsets() const {
+        std::string target = offsetsPath();
+        std::string tmp = target + ".tmp";
+        {
+            std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+            if (!file.is_open()) {
+                throw std::runtime_error("Cannot open file for writing: " + tmp);
+            }
+            OffsetsFileHeader h = stamp;
+            h.docs = starts.size();
+            std::vector<uint64_t> offsets(starts.begin(), starts.end());
+            Checksum sum;
+            sum.update(offsets.data(), offsets.size() * sizeof(uint64_t));
+            uint64_t value = sum.value();
+            file.write(reinterpret_cast<const char*>(&h), sizeof(h));
+            file.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint64_t));
+            file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+            if (!file) {
+                std::remove(tmp.c_str());
+                throw std::runtime_error("Failed writing offsets file: " + tmp);
+            }
+        }
+        if (std::rename(tmp.c_str(), target.c_str()) != 0) {
+            std::remove(tmp.c_str());
+            throw std::runtime_error("Cannot replace offsets file: " + target);
+        }
+    }
+
+    Doc doc(int id) {
+        if (!hasDoc(id)) {
+            throw std::out_of_range("Document " + std::to_string(id) + " is not in the corpus: " + path);
+        }
+        int length = data[starts[id]];
+        if (from_sidecar && (length < 0 || starts[id] + 1 + (size_t)length > words)) {
+            throw std::runtime_error("Corpus offsets file does not match document " + std::to_string(id) +
+                                     ", delete it: " + offsetsPath());
+        }
+        return Doc{data + starts[id] + 1, length};
+    }
+
+    // Heap bytes of the offset table; mapped pages are counted by the OS.
+    long long offsetBytes() const { return (long long)starts.capacity() * sizeof(size_t); }
+};
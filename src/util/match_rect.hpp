@@ -0,0 +1,129 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <ostream>
+#include <iterator>
+
+// A block of matching windows [i, j]: every start i in [start_lo, start_hi]
+// with every end j in [end_lo, end_hi]. Builders keep a <= b <= c <= d, so
+// every start is at most every end.
+struct MatchRect {
+    int start_lo, start_hi;
+    int end_lo, end_hi;
+
+    // The longest window in the block and its length.
+    int span() const { return end_hi - start_lo + 1; }
+};
+
+// Compact rectangles as Query::scanRects emits them (ordered by end_lo, then
+// start_lo, one per inner range of each run of ends). Touching start ranges
+// of the same run of ends are joined into the run's row. A rectangle then
+// stays open down the following touching runs for as long as each has a
+// start range containing its own, and a row's start range only opens a new
+// rectangle when no open one has exactly that range. Rectangles may overlap;
+// together they cover exactly the windows of the input, and each extends
+// over every run below it that could hold it.
+//
+// Identical or nested start ranges across runs collapse. A staircase, whose
+// start range moves at every run of ends, still keeps one rectangle per
+// step: no exact cover of it can do with fewer.
+inline std::vector<MatchRect> mergeRects(const std::vector<MatchRect> &rects) {
+    std::vector<MatchRect> merged;
+    std::vector<size_t> open, next;   // rectangles reaching the previous run
+    std::vector<MatchRect> row;
+    int prev_end_hi = -2;
+    size_t r = 0;
+    while (r < rects.size()) {
+        int end_lo = rects[r].end_lo;
+        row.clear();
+        for (; r < rects.size() && rects[r].end_lo == end_lo; r++) {
+            if (!row.empty() && rects[r].start_lo <= row.back().start_hi + 1) {
+                row.back().start_hi = std::max(row.back().start_hi, rects[r].start_hi);
+            } else {
+                row.push_back(rects[r]);
+            }
+        }
+
+        // Extend the open rectangles whose start range a row range contains:
+        // the row's ranges are disjoint, so only the one holding start_lo can.
+        next.clear();
+        if (end_lo == prev_end_hi + 1) {
+            for (size_t idx : open) {
+                MatchRect &m = merged[idx];
+                auto q = std::lower_bound(row.begin(), row.end(), m.start_lo,
+                                          [](const MatchRect &x, int start) { return x.start_hi < start; });
+                if (q != row.end() && q->start_lo <= m.start_lo && m.start_hi <= q->start_hi) {
+                    m.end_hi = q->end_hi;
+                    next.push_back(idx);
+                }
+            }
+        }
+
+        // Open a rectangle for each row range no extended one matches.
+        size_t p = 0;
+        std::vector<size_t> opened;
+        for (const MatchRect &cur : row) {
+            while (p < next.size() && merged[next[p]].start_lo < cur.start_lo) p++;
+            bool covered = false;
+            for (size_t t = p; t < next.size() && merged[next[t]].start_lo == cur.start_lo; t++) {
+                if (merged[next[t]].start_hi == cur.start_hi) covered = true;
+            }
+            if (!covered) {
+                merged.push_back(cur);
+                opened.push_back(merged.size() - 1);
+            }
+        }
+        open.clear();
+        std::merge(next.begin(), next.end(), opened.begin(), opened.end(), std::back_inserter(open),
+                   [&](size_t lhs, size_t rhs) {
+                       const MatchRect &a = merged[lhs], &b = merged[rhs];
+                       return a.start_lo != b.start_lo ? a.start_lo < b.start_lo : a.start_hi < b.start_hi;
+                   });
+        prev_end_hi = row.back().end_hi;
+    }
+    return merged;
+}
+
+// Index of the rectangle holding the document's longest matching window, or
+// -1 if there are none.
+inline int longestRect(const std::vector<MatchRect> &rects) {
+    int best = -1;
+    for (int r = 0; r < (int)rects.size(); r++) {
+        if (best < 0 || rects[r].span() > rects[best].span()) best = r;
+    }
+    return best;
+}
+
+// One document's results: its rectangles (merged, or one per range) and
+// their verification scores, if verified.
+struct DocMatches {
+    int doc;
+    std::vector<MatchRect> rects;
+    std::vector<double> scores;
+};
+
+// The first three results of a document: ranges as [first end, last start]
+// (the shortest window of each), or merged rectangles with the longest span.
+inline void printDocMatches(std::ostream &os, const DocMatches &m, bool merged) {
+    if (merged) {
+        const MatchRect &longest = m.rects[longestRect(m.rects)];
+        os << "Document " << m.doc << ": " << m.rects.size() << " rectangles, longest ["
+           << longest.start_lo << ", " << longest.end_hi << "]" << std::endl;
+    } else {
+        os << "Document " << m.doc << ": " << m.rects.size() << " matches" << std::endl;
+    }
+    for (size_t i = 0; i < std::min(m.rects.size(), size_t(3)); i++) {
+        const MatchRect &r = m.rects[i];
+        if (merged) {
+            os << "  Rect: start [" << r.start_lo << ", " << r.start_hi << "] x end ["
+               << r.end_lo << ", " << r.end_hi << "]";
+        } else {
+            os << "  Range: [" << r.end_lo << ", " << r.start_hi << "]";
+        }
+        if (!m.scores.empty()) os << " J=" << m.scores[i];
+        os << std::endl;
+    }
+    if (m.rects.size() > 3) {
+        os << "  ..." << (m.rects.size() - 3) << " more matches" << std::endl;
+    }
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <ostream>
+#include <cstdio>
+#include <stdexcept>
+#include <sys/resource.h>
+#include "json.hpp"
+
+// Bytes held by a vector's buffer (capacity, not size).
+template<typename T>
+long long vectorBytes(const std::vector<T> &v) {
+    return (long long)v.capacity() * sizeof(T);
+}
+
+// Bytes held by a corpus: token buffers plus the per-document vector headers.
+inline long long corpusBytes(const std::vector<std::vector<int>> &docs) {
+    long long bytes = vectorBytes(docs);
+    for (const auto &doc : docs) bytes += vectorBytes(doc);
+    return bytes;
+}
+
+// Peak resident set size of this process so far.
+inline long long peakRSSBytes() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return (long long)usage.ru_maxrss * 1024;  // kilobytes on Linux
+}
+
+inline std::string formatBytes(double bytes) {
+    const char *units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    int u = 0;
+    while (bytes >= 1024 && u < 4) {
+        bytes /= 1024;
+        u++;
+    }
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), u == 0 ? "%.0f %s" : "%.2f %s", bytes, units[u]);
+    return buf;
+}
+
+// Parse a byte count with an optional binary suffix: 4096, 512K, 64M, 2G.
+inline long long parseByteSize(const std::string &text) {
+    size_t pos = 0;
+    long long value = -1;
+    try {
+        value = std::stoll(text, &pos);
+    } catch (const std::exception &) {
+    }
+    int shift = 0;
+    if (pos + 1 == text.size()) {
+        switch (text[pos]) {
+        case 'K': case 'k': shift = 10; break;
+        case 'M': case 'm': shift = 20; break;
+        case 'G': case 'g': shift = 30; break;
+        default: pos = 0;
+        }
+        if (pos) pos++;
+    }
+    if (value < 0 || pos != text.size()) {
+        throw std::invalid_argument("Invalid size '" + text + "'; use bytes or a K, M or G suffix");
+    }
+    return value << shift;
+}
+
+// Named memory items, each with the bytes in use and the bytes reserved
+// (vector capacity), for the build and query reports.
+class MemoryReport {
+private:
+    struct Item {
+        std::string name;
+        long long used;
+        long long reserved;
+    };
+    std::vector<Item> items;
+
+public:
+    void add(const std::string &name, long long used, long long reserved) {
+        items.push_back({name, used, reserved});
+    }
+
+    void add(const std::string &name, long long bytes) { add(name, bytes, bytes); }
+
+    long long totalReserved() const {
+        long long sum = 0;
+        for (const auto &it : items) sum += it.reserved;
+        return sum;
+    }
+
+    void print(std::ostream &os) const {
+        os << "Memory:" << std::endl;
+        for (const auto &it : items) {
+            os << "  " << it.name << ": " << formatBytes(it.used);
+            if (it.reserved != it.used) os << " (capacity " << formatBytes(it.reserved) << ")";
+            os << std::endl;
+        }
+        os << "  accounted total: " << formatBytes(totalReserved()) << std::endl;
+        os << "  peak RSS: " << formatBytes(peakRSSBytes()) << std::endl;
+    }
+
+    void writeJson(JsonWriter &json) const {
+        json.beginObject();
+        for (const auto &it : items) {
+            json.key(it.name).beginObject()
+                .field("used", it.used)
+                .field("reserved", it.reserved)
+                .endObject();
+        }
+        json.field("accounted_total", totalReserved())
+            .field("peak_rss", peakRSSBytes());
+        json.endObject();
+    }
+};
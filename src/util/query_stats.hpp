@@ -0,0 +1,184 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <ostream>
+#include <iomanip>
+#include <algorithm>
+#include <limits>
+#include "json.hpp"
+
+// Per-query breakdown filled by Query::query. Times are in seconds.
+struct QueryTimings {
+    double signature = 0;    // getSignature
+    double lookup = 0;       // scanning the per-hash CW lists for the signature values
+    double recheck = 0;      // recomputing fingerprint matches from the corpus
+    double grouping = 0;     // grouping collided CWs by document
+    double scan = 0;         // outerScan / innerScan over all candidate documents
+    double confirm = 0;      // probing and rescanning prefiltered documents with all hash functions
+    double verify = 0;       // exact weighted Jaccard of result windows against the corpus
+    double output = 0;       // merging results into rectangles and writing them out
+    long long collided_cws = 0;
+    long long candidate_docs = 0;
+    long long result_ranges = 0;
+    long long result_rects = 0;   // merged rectangles written in their place
+    long long rejected = 0;   // fingerprint matches dropped by the recheck
+    long long confirmed_docs = 0;
+    long long verified = 0;     // result ranges scored against the corpus
+    long long unverified = 0;   // of those, dropped below the minimum similarity
+
+    double total() const { return signature + lookup + recheck + grouping + scan + confirm + verify + output; }
+};
+
+// Latency histogram with power-of-two buckets in microseconds: bucket 0 holds
+// values below 1 us, bucket i holds [2^(i-1), 2^i) us.
+class LatencyHistogram {
+private:
+    static const int kBuckets = 40;
+    std::vector<long long> buckets;
+    long long cnt = 0;
+    double sum = 0;
+    double lo = std::numeric_limits<double>::max();
+    double hi = 0;
+
+public:
+    LatencyHistogram() : buckets(kBuckets, 0) {}
+
+    void add(double seconds) {
+        double us = seconds * 1e6;
+        int b = 0;
+        while (b + 1 < kBuckets && us >= (double)(1LL << b)) b++;
+        buckets[b]++;
+        cnt++;
+        sum += seconds;
+        lo = std::min(lo, seconds);
+        hi = std::max(hi, seconds);
+    }
+
+    long long count() const { return cnt; }
+    double mean() const { return cnt ? sum / cnt : 0; }
+    double min() const { return cnt ? lo : 0; }
+    double max() const { return hi; }
+
+    // Upper bound of the bucket holding quantile q, clamped to the observed max.
+    double quantile(double q) const {
+        if (cnt == 0) return 0;
+        long long rank = std::max(1LL, (long long)(q * cnt + 0.5));
+        long long seen = 0;
+        for (int b = 0; b < kBuckets; b++) {
+            seen += buckets[b];
+            if (seen >= rank) return std::min(hi, (double)(1LL << b) / 1e6);
+        }
+        return hi;
+    }
+
+    void print(std::ostream &os, const std::string &name) const {
+        os << std::left << std::setw(10) << name << std::right
+           << " n=" << cnt << std::fixed << std::setprecision(3)
+           << " mean=" << mean() * 1e3 << "ms p50=" << quantile(0.5) * 1e3
+           << "ms p90=" << quantile(0.9) * 1e3 << "ms p99=" << quantile(0.99) * 1e3
+           << "ms max=" << max() * 1e3 << "ms" << std::defaultfloat << std::endl;
+    }
+
+    void writeJson(JsonWriter &json) const {
+        json.beginObject()
+            .field("count", cnt)
+            .field("mean", mean())
+            .field("min", min())
+            .field("max", max())
+            .field("p50", quantile(0.5))
+            .field("p90", quantile(0.9))
+            .field("p99", quantile(0.99));
+        json.key("buckets_us").beginArray();
+        int last = kBuckets - 1;
+        while (last > 0 && buckets[last] == 0) last--;
+        for (int b = 0; b <= last; b++) json.value(buckets[b]);
+        json.endArray();
+        json.endObject();
+    }
+};
+
+// Aggregate of many queries (batch mode): one histogram per phase plus the
+// distribution of collided CWs and candidate documents.
+class QueryStats {
+private:
+    LatencyHistogram signature, lookup, recheck, grouping, scan, confirm, verify, output, total;
+    long long collided_cws = 0, candidate_docs = 0, result_ranges = 0, result_rects = 0, rejected = 0,
+              confirmed_docs = 0;
+    long long verified = 0, unverified = 0;
+    long long max_collided = 0, max_candidates = 0;
+
+public:
+    void add(const QueryTimings &t) {
+        signature.add(t.signature);
+        lookup.add(t.lookup);
+        recheck.add(t.recheck);
+        grouping.add(t.grouping);
+        scan.add(t.scan);
+        confirm.add(t.confirm);
+        verify.add(t.verify);
+        output.add(t.output);
+        total.add(t.total());
+        collided_cws += t.collided_cws;
+        candidate_docs += t.candidate_docs;
+        result_ranges += t.result_ranges;
+        result_rects += t.result_rects;
+        rejected += t.rejected;
+        confirmed_docs += t.confirmed_docs;
+        verified += t.verified;
+        unverified += t.unverified;
+        max_collided = std::max(max_collided, t.collided_cws);
+        max_candidates = std::max(max_candidates, t.candidate_docs);
+    }
+
+    long long count() const { return total.count(); }
+
+    void print(std::ostream &os) const {
+        long long n = std::max(1LL, count());
+        os << "Latency over " << count() << " queries:" << std::endl;
+        signature.print(os, "signature");
+        lookup.print(os, "lookup");
+        if (recheck.max() > 0) recheck.print(os, "recheck");
+        grouping.print(os, "grouping");
+        scan.print(os, "scan");
+        if (confirm.max() > 0) confirm.print(os, "confirm");
+        if (verify.max() > 0) verify.print(os, "verify");
+        if (output.max() > 0) output.print(os, "output");
+        total.print(os, "total");
+        os << "Collided CWs: " << collided_cws << " (mean " << collided_cws / n << ", max " << max_collided << ")"
+           << ", candidate docs: " << candidate_docs << " (mean " << candidate_docs / n << ", max " << max_candidates << ")"
+           << ", result ranges: " << result_ranges;
+        if (result_rects > 0) os << ", rectangles written: " << result_rects;
+        if (rejected > 0) os << ", rejected fingerprint matches: " << rejected;
+        if (confirmed_docs > 0) os << ", confirmed docs: " << confirmed_docs;
+        if (verified > 0) os << ", verified ranges: " << verified << " (" << unverified << " below similarity)";
+        os << std::endl;
+    }
+
+    void writeJson(std::ostream &os) const {
+        JsonWriter json(os);
+        json.beginObject().field("queries", count());
+        json.key("latency").beginObject();
+        json.key("signature"); signature.writeJson(json);
+        json.key("lookup"); lookup.writeJson(json);
+        json.key("recheck"); recheck.writeJson(json);
+        json.key("grouping"); grouping.writeJson(json);
+        json.key("scan"); scan.writeJson(json);
+        json.key("confirm"); confirm.writeJson(json);
+        json.key("verify"); verify.writeJson(json);
+        json.key("output"); output.writeJson(json);
+        json.key("total"); total.writeJson(json);
+        json.endObject();
+        json.field("collided_cws", collided_cws)
+            .field("max_collided_cws", max_collided)
+            .field("candidate_docs", candidate_docs)
+            .field("max_candidate_docs", max_candidates)
+            .field("result_ranges", result_ranges)
+            .field("result_rects", result_rects)
+            .field("rejected_fingerprint_matches", rejected)
+            .field("confirmed_docs", confirmed_docs)
+            .field("verified_ranges", verified)
+            .field("ranges_below_similarity", unverified);
+        json.endObject();
+        os << "\n";
+    }
+};
@@ -0,0 +1,82 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include "hasher.hpp"
+#include "doc_weights.hpp"
+#include "memory.hpp"
+
+// Hash values of every (token, x-th occurrence) pair of one document, stored
+// row by row: token t owns rows [base[t], base[t] + f_t). A window whose
+// local count of t is x hashes t to value(t, x), so builders that look at the
+// same occurrences under many ranges evaluate the hasher once per position
+// instead of once per (range, position).
+template<typename WeightType>
+class RankHashTable {
+private:
+    std::vector<int> base;          // per token: first slot of its row (valid for tokens in the doc)
+    std::vector<int> len;           // per token: occurrences in the doc (row length)
+    std::vector<int> occ;           // per position: 0-based occurrence index of its token
+    std::vector<int> pos;           // per slot: position of that occurrence
+    std::vector<WeightType> hash;   // per slot: hash of (token, occurrence count)
+    int max_freq = 0;
+
+public:
+    explicit RankHashTable(int tokenNum) : base(tokenNum), len(tokenNum) {}
+
+    long long memoryBytes() const
+    {
+        return vectorBytes(base) + vectorBytes(len) + vectorBytes(occ) + vectorBytes(pos) + vectorBytes(hash);
+    }
+
+    // Lay out the rows of doc. cnt is tokenNum-sized zeroed scratch and is
+    // left zeroed on return.
+    void index(const std::vector<int> &doc, std::vector<int> &cnt)
+    {
+        int n = (int)doc.size();
+        occ.resize(n);
+        pos.resize(n);
+        hash.resize(n);
+        max_freq = 0;
+        for (int i = 0; i < n; i++)
+        {
+            occ[i] = cnt[doc[i]]++;
+            max_freq = std::max(max_freq, cnt[doc[i]]);
+        }
+        int offset = 0;
+        for (int i = 0; i < n; i++)
+        {
+            if (occ[i] == 0)
+            {
+                base[doc[i]] = offset;
+                len[doc[i]] = cnt[doc[i]];
+                offset += cnt[doc[i]];
+            }
+        }
+        for (int i = 0; i < n; i++)
+        {
+            pos[base[doc[i]] + occ[i]] = i;
+            cnt[doc[i]] = 0;
+        }
+    }
+
+    // Fill the hash of every slot for one hash function from the weights of
+    // the same document, one token row at a time.
+    void evaluate(const Hasher<WeightType> &hasher, int hid, const std::vector<int> &doc,
+                  const DocWeights<WeightType> &weights)
+    {
+        for (int slot = 0; slot < (int)doc.size(); )
+        {
+            int t = doc[pos[slot]];
+            hasher.evalRun(hid, t, weights.row(t), len[t], hash.data() + slot);
+            slot += len[t];
+        }
+    }
+
+    int maxFreq() const { return max_freq; }
+    int occurrence(int i) const { return occ[i]; }
+    int rowOf(int token) const { return base[token]; }
+    int count(int token) const { return len[token]; }
+    int position(int slot) const { return pos[slot]; }
+    WeightType value(int token, int x) const { return hash[base[token] + x - 1]; }
+    const WeightType *row(int token) const { return hash.data() + base[token]; }
+};
@@ -0,0 +1,124 @@
+#pragma once
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+#include "json.hpp"
+#include "match_rect.hpp"
+
+// Streams query results to a file, one entry per matching document, as they
+// are produced.
+//
+// JSONL: one object per line,
+//   {"query":0,"doc":12,"longest":[i,j],"rects":[[start_lo,start_hi,end_lo,end_hi],...],"scores":[...]}
+// with "scores" (exact similarity of each rectangle's longest window, or of
+// its shortest if only that reaches the minimum) only when results are
+// verified.
+//
+// Binary (little-endian):
+//   uint32 magic, uint32 version, uint32 flags (bit 0: scores present)
+//   per document: int32 query, int32 doc, int32 rectangle count,
+//   int32 longest start, int32 longest end, then per rectangle int32
+//   start_lo, start_hi, end_lo, end_hi, followed by a double score per
+//   rectangle if scores are present.
+class ResultWriter {
+public:
+    enum class Format { JSONL, BINARY };
+
+    static constexpr uint32_t kMagic = 0x5352414f;   // "OARS" in file byte order
+    static constexpr uint32_t kVersion = 1;
+
+private:
+    std::ofstream out;
+    std::string path;
+    Format format;
+    bool with_scores;
+    int query_id = 0;
+    long long docs = 0, rects_written = 0;
+
+    void put(int32_t v) { out.write(reinterpret_cast<const char*>(&v), sizeof(v)); }
+
+public:
+    // Files named *.bin are written in the binary format, others as JSONL.
+    static Format formatFor(const std::string &filename) {
+        const std::string ext = ".bin";
+        bool bin = filename.size() >= ext.size() &&
+                   filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0;
+        return bin ? Format::BINARY : Format::JSONL;
+    }
+
+    ResultWriter(const std::string &path_, bool with_scores_)
+        : path(path_), format(formatFor(path_)), with_scores(with_scores_) {
+        out.open(path, format == Format::BINARY ? std::ios::binary : std::ios::out);
+        if (!out.is_open()) {
+            throw std::runtime_error("Cannot open file for writing: " + path);
+        }
+        if (format == Format::BINARY) {
+            uint32_t flags = with_scores ? 1 : 0;
+            out.write(reinterpret_cast<const char*>(&kMagic), sizeof(kMagic));
+            out.write(reinterpret_cast<const char*>(&kVersion), sizeof(kVersion));
+            out.write(reinterpret_cast<const char*>(&flags), sizeof(flags));
+        }
+    }
+
+    ~ResultWriter() {
+        if (out.is_open()) out.flush();
+    }
+
+    ResultWriter(const ResultWriter &) = delete;
+    ResultWriter &operator=(const ResultWriter &) = delete;
+
+    // Number of the query whose results follow.
+    void setQuery(int id) { query_id = id; }
+
+    // scores is parallel to rects, or empty when not verifying.
+    void write(int doc, const std::vector<MatchRect> &rects, const std::vector<double> &scores) {
+        if (rects.empty()) return;
+        if (with_scores && scores.size() != rects.size()) {
+            throw std::logic_error("Result writer expects a score per rectangle");
+        }
+        const MatchRect &longest = rects[longestRect(rects)];
+
+        if (format == Format::BINARY) {
+            put(query_id);
+            put(doc);
+            put((int32_t)rects.size());
+            put(longest.start_lo);
+            put(longest.end_hi);
+            for (const MatchRect &r : rects) {
+                put(r.start_lo);
+                put(r.start_hi);
+                put(r.end_lo);
+                put(r.end_hi);
+            }
+            if (with_scores) {
+                out.write(reinterpret_cast<const char*>(scores.data()), scores.size() * sizeof(double));
+            }
+        } else {
+            JsonWriter json(out);
+            json.beginObject().field("query", query_id).field("doc", doc);
+            json.key("longest").beginArray().value(longest.start_lo).value(longest.end_hi).endArray();
+            json.key("rects").beginArray();
+            for (const MatchRect &r : rects) {
+                json.beginArray().value(r.start_lo).value(r.start_hi).value(r.end_lo).value(r.end_hi).endArray();
+            }
+            json.endArray();
+            if (with_scores) {
+                json.key("scores").beginArray();
+                for (double s : scores) json.value(s);
+                json.endArray();
+            }
+            json.endObject();
+            out << '\n';
+        }
+        if (!out) {
+            throw std::runtime_error("Write failed: " + path);
+        }
+        docs++;
+        rects_written += rects.size();
+    }
+
+    long long docsWritten() const { return docs; }
+    long long rectsWritten() const { return rects_written; }
+};
@@ -0,0 +1,223 @@
+#pragma once
+#include <cstring>
+
+// SIMD helpers. findFirstLess uses GCC/Clang vector extensions: 16-byte
+// vectors map to one SSE2/NEON register, so it vectorizes without extra
+// target flags. The findEqual kernels use AVX2/AVX-512 intrinsics in
+// functions compiled for those targets and are picked at runtime.
+
+// Position of the first v[i] < x with from <= i < n, or n if there is none.
+template<typename T>
+inline int findFirstLess(const T *v, int from, int n, T x)
+{
+    typedef T vec __attribute__((vector_size(16)));
+    typedef long long mask __attribute__((vector_size(16)));
+    constexpr int kLanes = 16 / sizeof(T);
+    constexpr int kStep = 4 * kLanes;
+
+    vec key = vec{} + x;
+    int i = from;
+    for (; i + kStep <= n; i += kStep)
+    {
+        vec v0, v1, v2, v3;
+        std::memcpy(&v0, v + i, sizeof(vec));
+        std::memcpy(&v1, v + i + kLanes, sizeof(vec));
+        std::memcpy(&v2, v + i + 2 * kLanes, sizeof(vec));
+        std::memcpy(&v3, v + i + 3 * kLanes, sizeof(vec));
+        mask hit = (mask)(((v0 < key) | (v1 < key)) | ((v2 < key) | (v3 < key)));
+        if (hit[0] | hit[1])
+        {
+            break;
+        }
+    }
+    for (; i < n; i++)
+    {
+        if (v[i] < x)
+        {
+            return i;
+        }
+    }
+    return n;
+}
+
+// Equality scan: write the positions i < n with v[i] == x to out (which must
+// hold n ints) and return how many there are. Collision probing over a hash
+// column hits rarely, so the kernels test several vectors at once and only
+// extract positions from blocks that contain a match. findEqual dispatches at
+// runtime to AVX-512, AVX2 or the scalar loop.
+
+// Scalar scan of [from, n), appending to out[cnt..]. Returns the new count.
+template<typename T>
+inline int findEqualTail(const T *v, int from, int n, T x, int *out, int cnt)
+{
+    for (int i = from; i < n; i++)
+    {
+        if (v[i] == x)
+        {
+            out[cnt++] = i;
+        }
+    }
+    return cnt;
+}
+
+template<typename T>
+inline int findEqualScalar(const T *v, int n, T x, int *out)
+{
+    return findEqualTail(v, 0, n, x, out, 0);
+}
+
+enum class SimdLevel
+{
+    SCALAR,
+    AVX2,
+    AVX512
+};
+
+inline const char *simdLevelName(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::AVX512: return "avx512";
+    case SimdLevel::AVX2: return "avx2";
+    default: return "scalar";
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WEIGHTALIGN_X86_KERNELS 1
+
+__attribute__((target("avx2")))
+inline int findEqualAVX2(const int *v, int n, int x, int *out)
+{
+    const __m256i key = _mm256_set1_epi32(x);
+    int cnt = 0, i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i e0 = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(v + i)), key);
+        __m256i e1 = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(v + i + 8)), key);
+        __m256i e2 = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(v + i + 16)), key);
+        __m256i e3 = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(v + i + 24)), key);
+        __m256i any = _mm256_or_si256(_mm256_or_si256(e0, e1), _mm256_or_si256(e2, e3));
+        if (_mm256_testz_si256(any, any))
+        {
+            continue;
+        }
+        unsigned long long bits =
+            (unsigned long long)(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(e0)) |
+            (unsigned long long)(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(e1)) << 8 |
+            (unsigned long long)(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(e2)) << 16 |
+            (unsigned long long)(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(e3)) << 24;
+        while (bits)
+        {
+            out[cnt++] = i + __builtin_ctzll(bits);
+            bits &= bits - 1;
+        }
+    }
+    return findEqualTail(v, i, n, x, out, cnt);
+}
+
+__attribute__((target("avx2")))
+inline int findEqualAVX2(const double *v, int n, double x, int *out)
+{
+    const __m256d key = _mm256_set1_pd(x);
+    int cnt = 0, i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256d e0 = _mm256_cmp_pd(_mm256_loadu_pd(v + i), key, _CMP_EQ_OQ);
+        __m256d e1 = _mm256_cmp_pd(_mm256_loadu_pd(v + i + 4), key, _CMP_EQ_OQ);
+        __m256d e2 = _mm256_cmp_pd(_mm256_loadu_pd(v + i + 8), key, _CMP_EQ_OQ);
+        __m256d e3 = _mm256_cmp_pd(_mm256_loadu_pd(v + i + 12), key, _CMP_EQ_OQ);
+        __m256d any = _mm256_or_pd(_mm256_or_pd(e0, e1), _mm256_or_pd(e2, e3));
+        if (_mm256_testz_pd(any, any))
+        {
+            continue;
+        }
+        unsigned bits = (unsigned)_mm256_movemask_pd(e0) | (unsigned)_mm256_movemask_pd(e1) << 4 |
+                        (unsigned)_mm256_movemask_pd(e2) << 8 | (unsigned)_mm256_movemask_pd(e3) << 12;
+        while (bits)
+        {
+            out[cnt++] = i + __builtin_ctz(bits);
+            bits &= bits - 1;
+        }
+    }
+    return findEqualTail(v, i, n, x, out, cnt);
+}
+
+__attribute__((target("avx512f")))
+inline int findEqualAVX512(const int *v, int n, int x, int *out)
+{
+    const __m512i key = _mm512_set1_epi32(x);
+    const __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    int cnt = 0, i = 0;
+    for (; i + 64 <= n; i += 64)
+    {
+        __mmask16 m0 = _mm512_cmpeq_epi32_mask(_mm512_loadu_si512(v + i), key);
+        __mmask16 m1 = _mm512_cmpeq_epi32_mask(_mm512_loadu_si512(v + i + 16), key);
+        __mmask16 m2 = _mm512_cmpeq_epi32_mask(_mm512_loadu_si512(v + i + 32), key);
+        __mmask16 m3 = _mm512_cmpeq_epi32_mask(_mm512_loadu_si512(v + i + 48), key);
+        if ((m0 | m1 | m2 | m3) == 0)
+        {
+            continue;
+        }
+        __mmask16 ms[4] = {m0, m1, m2, m3};
+        for (int j = 0; j < 4; j++)
+        {
+            if (ms[j] == 0) continue;
+            __m512i pos = _mm512_add_epi32(lane, _mm512_set1_epi32(i + 16 * j));
+            _mm512_mask_compressstoreu_epi32(out + cnt, ms[j], pos);
+            cnt += __builtin_popcount(ms[j]);
+        }
+    }
+    return findEqualTail(v, i, n, x, out, cnt);
+}
+
+__attribute__((target("avx512f")))
+inline int findEqualAVX512(const double *v, int n, double x, int *out)
+{
+    const __m512d key = _mm512_set1_pd(x);
+    int cnt = 0, i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __mmask8 m0 = _mm512_cmp_pd_mask(_mm512_loadu_pd(v + i), key, _CMP_EQ_OQ);
+        __mmask8 m1 = _mm512_cmp_pd_mask(_mm512_loadu_pd(v + i + 8), key, _CMP_EQ_OQ);
+        __mmask8 m2 = _mm512_cmp_pd_mask(_mm512_loadu_pd(v + i + 16), key, _CMP_EQ_OQ);
+        __mmask8 m3 = _mm512_cmp_pd_mask(_mm512_loadu_pd(v + i + 24), key, _CMP_EQ_OQ);
+        unsigned bits = (unsigned)m0 | (unsigned)m1 << 8 | (unsigned)m2 << 16 | (unsigned)m3 << 24;
+        while (bits)
+        {
+            out[cnt++] = i + __builtin_ctz(bits);
+            bits &= bits - 1;
+        }
+    }
+    return findEqualTail(v, i, n, x, out, cnt);
+}
+#endif
+
+// Best level this CPU supports, detected once.
+inline SimdLevel detectSimdLevel()
+{
+#ifdef WEIGHTALIGN_X86_KERNELS
+    static const SimdLevel level = []() {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return SimdLevel::AVX512;
+        if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+        return SimdLevel::SCALAR;
+    }();
+    return level;
+#else
+    return SimdLevel::SCALAR;
+#endif
+}
+
+// Levels above what the CPU supports fall back to the best supported one.
+template<typename T>
+inline int findEqual(const T *v, int n, T x, int *out, SimdLevel level = detectSimdLevel())
+{
+#ifdef WEIGHTALIGN_X86_KERNELS
+    if (level > detectSimdLevel()) level = detectSimdLevel();
+    if (level == SimdLevel::AVX512) return findEqualAVX512(v, n, x, out);
+    if (level == SimdLevel::AVX2) return findEqualAVX2(v, n, x, out);
+#endif
+    return findEqualScalar(v, n, x, out);
+}
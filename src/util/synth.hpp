@@ -0,0 +1,113 @@
+#pragma once
+#include <vector>
+#include <random>
+#include <string>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+enum class LengthDist {
+    FIXED,
+    UNIFORM,
+    NORMAL,
+    LOGNORMAL
+};
+
+inline LengthDist parseLengthDist(const std::string &name) {
+    if (name == "fixed") return LengthDist::FIXED;
+    if (name == "uniform") return LengthDist::UNIFORM;
+    if (name == "normal") return LengthDist::NORMAL;
+    if (name == "lognormal") return LengthDist::LOGNORMAL;
+    throw std::invalid_argument("Unknown length distribution '" + name + "'. Valid: fixed, uniform, normal, lognormal.");
+}
+
+inline uint64_t splitmix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+struct SynthConfig {
+    int vocab = 50257;
+    double zipf = 1.0;          // exponent of the token rank distribution; 0 = uniform
+    int mean_length = 512;
+    LengthDist length_dist = LengthDist::LOGNORMAL;
+    double spread = 0.5;        // lognormal sigma; relative half-width (uniform) or stddev (normal)
+    int min_length = 1;
+    uint64_t seed = 1;
+};
+
+// Deterministic synthetic corpus with Zipfian token frequencies. Document i
+// depends only on (seed, i), so any document can be regenerated on demand
+// instead of keeping the corpus in memory. Token ids are a seeded permutation
+// of the ranks, so frequent tokens are spread over the id space as in real
+// tokenizers.
+class SyntheticCorpus {
+private:
+    SynthConfig cfg;
+    std::vector<int> token_of_rank;
+    std::discrete_distribution<int> rank_dist;
+
+    std::mt19937_64 rngFor(int doc_id, uint64_t salt) const {
+        return std::mt19937_64(splitmix64(cfg.seed ^ splitmix64((static_cast<uint64_t>(doc_id) << 8) ^ salt)));
+    }
+
+public:
+    explicit SyntheticCorpus(const SynthConfig &cfg_) : cfg(cfg_), token_of_rank(cfg_.vocab) {
+        if (cfg.vocab <= 0) {
+            throw std::invalid_argument("Vocabulary size must be positive");
+        }
+        std::vector<double> weights(cfg.vocab);
+        for (int r = 0; r < cfg.vocab; r++) {
+            weights[r] = 1.0 / std::pow(r + 1.0, cfg.zipf);
+        }
+        rank_dist = std::discrete_distribution<int>(weights.begin(), weights.end());
+        std::iota(token_of_rank.begin(), token_of_rank.end(), 0);
+        std::mt19937_64 perm(splitmix64(cfg.seed));
+        std::shuffle(token_of_rank.begin(), token_of_rank.end(), perm);
+    }
+
+    const SynthConfig &config() const { return cfg; }
+
+    int length(int doc_id) const {
+        std::mt19937_64 rng = rngFor(doc_id, 1);
+        double len = cfg.mean_length;
+        switch (cfg.length_dist) {
+            case LengthDist::FIXED:
+                break;
+            case LengthDist::UNIFORM: {
+                std::uniform_real_distribution<double> d(cfg.mean_length * (1.0 - cfg.spread),
+                                                         cfg.mean_length * (1.0 + cfg.spread));
+                len = d(rng);
+                break;
+            }
+            case LengthDist::NORMAL: {
+                std::normal_distribution<double> d(cfg.mean_length, cfg.mean_length * cfg.spread);
+                len = d(rng);
+                break;
+            }
+            case LengthDist::LOGNORMAL: {
+                double mu = std::log(static_cast<double>(cfg.mean_length)) - cfg.spread * cfg.spread / 2;
+                std::lognormal_distribution<double> d(mu, cfg.spread);
+                len = d(rng);
+                break;
+            }
+        }
+        return std::max(cfg.min_length, static_cast<int>(std::lround(len)));
+    }
+
+    int randomToken(std::mt19937_64 &rng) {
+        return token_of_rank[rank_dist(rng)];
+    }
+
+    void generate(int doc_id, std::vector<int> &doc) {
+        doc.resize(length(doc_id));
+        std::mt19937_64 rng = rngFor(doc_id, 2);
+        for (auto &t : doc) {
+            t = randomToken(rng);
+        }
+    }
+};
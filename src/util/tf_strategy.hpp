@@ -3,6 +3,7 @@
 #include <algorithm>
 #include <type_traits>
 #include <stdexcept>
+#include <string>
 
 enum class TFMode {
     RAW,
@@ -73,3 +74,86 @@ public:
         }
     }
 };
+
+inline TFMode parseTFMode(const std::string &name) {
+    if (name == "raw") return TFMode::RAW;
+    if (name == "log") return TFMode::LOG_NORMALIZED;
+    if (name == "boolean") return TFMode::BOOLEAN;
+    if (name == "augmented") return TFMode::AUGMENTED;
+    if (name == "square") return TFMode::SQUARE;
+    throw std::invalid_argument(
+        "Unknown TF strategy '" + name + "'. Valid: raw, log, boolean, augmented, square.");
+}
+
+// Compile-time TF policies. Builders and Query take one as a template
+// argument so the weighting inlines into their inner loops; the mode argument
+// of weight() is only read by DynamicTF, which keeps the runtime switch.
+// supports<W> is false for combinations that need DOUBLE weights.
+struct DynamicTF {
+    static constexpr bool is_static = false;
+    template<typename W> static constexpr bool supports = true;
+
+    template<typename W>
+    static W weight(TFMode mode, int freq, int max_freq) {
+        return TFCalculator<W>::calculate(mode, freq, max_freq);
+    }
+};
+
+struct RawTF {
+    static constexpr bool is_static = true;
+    static constexpr TFMode mode = TFMode::RAW;
+    template<typename W> static constexpr bool supports = true;
+
+    template<typename W>
+    static W weight(TFMode, int freq, int) { return TFCalculator<W>::raw(freq); }
+};
+
+struct LogTF {
+    static constexpr bool is_static = true;
+    static constexpr TFMode mode = TFMode::LOG_NORMALIZED;
+    template<typename W> static constexpr bool supports = std::is_same_v<W, double>;
+
+    template<typename W>
+    static W weight(TFMode, int freq, int) { return TFCalculator<W>::log_normalized(freq); }
+};
+
+struct BooleanTF {
+    static constexpr bool is_static = true;
+    static constexpr TFMode mode = TFMode::BOOLEAN;
+    template<typename W> static constexpr bool supports = std::is_same_v<W, double>;
+
+    template<typename W>
+    static W weight(TFMode, int freq, int) { return TFCalculator<W>::boolean_tf(freq); }
+};
+
+struct AugmentedTF {
+    static constexpr bool is_static = true;
+    static constexpr TFMode mode = TFMode::AUGMENTED;
+    template<typename W> static constexpr bool supports = std::is_same_v<W, double>;
+
+    template<typename W>
+    static W weight(TFMode, int freq, int max_freq) { return TFCalculator<W>::augmented(freq, max_freq); }
+};
+
+struct SquareTF {
+    static constexpr bool is_static = true;
+    static constexpr TFMode mode = TFMode::SQUARE;
+    template<typename W> static constexpr bool supports = std::is_same_v<W, double>;
+
+    template<typename W>
+    static W weight(TFMode, int freq, int) { return TFCalculator<W>::square(freq); }
+};
+
+// Call f with a value of the policy type for mode; the single runtime branch
+// before entering a builder or query engine.
+template<typename F>
+void withTFPolicy(TFMode mode, F &&f) {
+    switch (mode) {
+        case TFMode::RAW: f(RawTF{}); break;
+        case TFMode::LOG_NORMALIZED: f(LogTF{}); break;
+        case TFMode::BOOLEAN: f(BooleanTF{}); break;
+        case TFMode::AUGMENTED: f(AugmentedTF{}); break;
+        case TFMode::SQUARE: f(SquareTF{}); break;
+        default: throw std::invalid_argument("Unknown TF mode");
+    }
+}
@@ -0,0 +1,152 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <istream>
+#include <ostream>
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+#include <stdexcept>
+
+// Throw unless every token of doc is in [0, tokenNum). Token ids index the
+// builders' and the hasher's per-token tables unchecked, so corpora are
+// checked once as they are read.
+inline void checkTokens(const int *tokens, int length, int tokenNum, long long doc_id) {
+    for (int i = 0; i < length; i++) {
+        if (tokens[i] < 0 || tokens[i] >= tokenNum) {
+            throw std::out_of_range("Token " + std::to_string(tokens[i]) + " at position " + std::to_string(i) +
+                                    " of document " + std::to_string(doc_id) + " outside the vocabulary [0, " +
+                                    std::to_string(tokenNum) + "); set -v");
+        }
+    }
+}
+
+inline void checkTokens(const std::vector<std::vector<int>> &docs, int tokenNum, long long first_doc = 0) {
+    for (size_t d = 0; d < docs.size(); d++) {
+        checkTokens(docs[d].data(), (int)docs[d].size(), tokenNum, first_doc + (long long)d);
+    }
+}
+
+// A permutation of the vocabulary that gives the tokens occurring in a corpus
+// the ids 0..used-1, most frequent first, followed by the rest in their
+// original order. Builders index their per-token tables (counts, next
+// pointers, weights, rank rows, IDF) by token id, so under the map the
+// entries a document touches sit in a dense prefix, with the hottest in the
+// first few cache lines, however large the vocabulary.
+//
+// Only the layout changes: the hasher keys its random draws on the original
+// id (Hasher::hashId), so CW values, and the index blocks, are those of an
+// unmapped build. Stored with the hasher configuration and applied to
+// queries and corpus documents by Query.
+class VocabMap {
+private:
+    std::vector<int> to_dense;   // original id -> dense id
+    std::vector<int> to_orig;    // dense id -> original id
+    int used = 0;
+
+    void fillRest() {
+        to_dense.assign(to_orig.size(), -1);
+        for (int d = 0; d < used; d++) {
+            if (to_orig[d] < 0 || to_orig[d] >= (int)to_orig.size() || to_dense[to_orig[d]] != -1) {
+                throw std::runtime_error("Vocabulary map is not a permutation");
+            }
+            to_dense[to_orig[d]] = d;
+        }
+        int next = used;
+        for (int t = 0; t < (int)to_orig.size(); t++) {
+            if (to_dense[t] == -1) {
+                to_dense[t] = next;
+                to_orig[next++] = t;
+            }
+        }
+    }
+
+public:
+    VocabMap() = default;
+
+    // Order by occurrence count, descending; ties keep the original order.
+    static VocabMap byFrequency(const std::vector<long long> &occurrences) {
+        VocabMap m;
+        int n = (int)occurrences.size();
+        std::vector<int> order(n);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(),
+                         [&](int a, int b) { return occurrences[a] > occurrences[b]; });
+        m.used = 0;
+        while (m.used < n && occurrences[order[m.used]] > 0) m.used++;
+        m.to_orig.assign(n, 0);
+        std::copy(order.begin(), order.begin() + m.used, m.to_orig.begin());
+        m.fillRest();
+        return m;
+    }
+
+    // Occurrences of each token over docs, which checkTokens must accept.
+    static std::vector<long long> countOccurrences(const std::vector<std::vector<int>> &docs, int tokenNum) {
+        std::vector<long long> count(tokenNum, 0);
+        for (size_t d = 0; d < docs.size(); d++) {
+            checkTokens(docs[d].data(), (int)docs[d].size(), tokenNum, (long long)d);
+            for (int t : docs[d]) count[t]++;
+        }
+        return count;
+    }
+
+    bool empty() const { return to_orig.empty(); }
+    int size() const { return (int)to_orig.size(); }
+    int usedTokens() const { return used; }
+
+    int dense(int token) const {
+        if (token < 0 || token >= (int)to_dense.size()) {
+            throw std::out_of_range("Token " + std::to_string(token) + " outside the vocabulary [0, " +
+                                    std::to_string(to_dense.size()) + ")");
+        }
+        return to_dense[token];
+    }
+    int orig(int id) const { return to_orig[id]; }
+    const std::vector<int> &origIds() const { return to_orig; }
+
+    // Rewrite tokens to dense ids in place; doc_id is for the error.
+    void remap(int *tokens, int length, long long doc_id) const {
+        checkTokens(tokens, length, size(), doc_id);
+        for (int i = 0; i < length; i++) tokens[i] = to_dense[tokens[i]];
+    }
+
+    void remap(std::vector<std::vector<int>> &docs, long long first_doc = 0) const {
+        for (size_t d = 0; d < docs.size(); d++) {
+            remap(docs[d].data(), (int)docs[d].size(), first_doc + (long long)d);
+        }
+    }
+
+    // A table indexed by original id, reordered to be indexed by dense id.
+    template<typename T>
+    std::vector<T> permute(const std::vector<T> &by_orig) const {
+        std::vector<T> out(by_orig.size());
+        for (size_t d = 0; d < out.size(); d++) out[d] = by_orig[to_orig[d]];
+        return out;
+    }
+
+    // uint32 used, then the original ids of dense ids 0..used-1; the rest
+    // follow from the vocabulary size.
+    void save(std::ostream &out) const {
+        uint32_t n = used;
+        out.write(reinterpret_cast<const char*>(&n), sizeof(n));
+        out.write(reinterpret_cast<const char*>(to_orig.data()), sizeof(int) * (size_t)used);
+    }
+
+    void load(std::istream &in, int tokenNum) {
+        uint32_t n = 0;
+        in.read(reinterpret_cast<char*>(&n), sizeof(n));
+        if (!in || n > (uint32_t)tokenNum) {
+            throw std::runtime_error("Corrupt vocabulary map");
+        }
+        used = (int)n;
+        to_orig.assign(tokenNum, 0);
+        if (!in.read(reinterpret_cast<char*>(to_orig.data()), sizeof(int) * (size_t)used)) {
+            throw std::runtime_error("Vocabulary map truncated");
+        }
+        fillRest();
+    }
+
+    long long bytes() const {
+        return (long long)(to_dense.capacity() + to_orig.capacity()) * sizeof(int);
+    }
+};
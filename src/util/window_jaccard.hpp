@@ -0,0 +1,97 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include "hasher.hpp"
+#include "doc_weights.hpp"
+
+// Exact weighted Jaccard between a query and windows of one document, under
+// the weighting the sketches estimate: a token occurring x times weighs the
+// TF weight of x (times its IDF), with the query's own max frequency for the
+// query and the document's for its windows, as getSignature and the builders
+// use them. Then J = sum min(q, w) / sum max(q, w).
+//
+// The window's token counts and the three sums are kept incrementally, so
+// moving from one window to the next costs the number of positions its ends
+// move; scoring a document's windows in order of start costs about their
+// total span rather than their total length.
+template<typename WeightType>
+class WindowJaccard {
+private:
+    std::vector<double> qw;          // per token: query weight, 0 if absent
+    std::vector<int> query_tokens;   // tokens with qw set
+    std::vector<int> cnt;            // per token: occurrences in the window
+    double sum_q = 0, sum_w = 0, sum_min = 0;
+
+    const int *doc = nullptr;
+    const DocWeights<WeightType> *weights = nullptr;
+    int lo = 0, hi = 0;              // current window [lo, hi)
+
+    double weightAt(int t, int x) const { return x ? static_cast<double>(weights->weight(t, x)) : 0.0; }
+
+    void add(int t) {
+        double before = weightAt(t, cnt[t]);
+        double after = weightAt(t, ++cnt[t]);
+        sum_w += after - before;
+        sum_min += std::min(qw[t], after) - std::min(qw[t], before);
+    }
+
+    void remove(int t) {
+        double before = weightAt(t, cnt[t]);
+        double after = weightAt(t, --cnt[t]);
+        sum_w += after - before;
+        sum_min += std::min(qw[t], after) - std::min(qw[t], before);
+    }
+
+public:
+    explicit WindowJaccard(int tokenNum) : qw(tokenNum, 0), cnt(tokenNum, 0) {}
+
+    // tfOf(x, max_freq) is the TF weight of an x-th occurrence.
+    template<typename TFFunc>
+    void setQuery(const std::vector<int> &query, const Hasher<WeightType> &hasher, TFFunc tfOf) {
+        for (int t : query_tokens) qw[t] = 0;
+        query_tokens.clear();
+        int max_freq = 0;
+        for (int t : query) {
+            if (cnt[t]++ == 0) query_tokens.push_back(t);
+            max_freq = std::max(max_freq, cnt[t]);
+        }
+        bool use_idf = std::is_same_v<WeightType, double> && hasher.isIDFEnabled();
+        sum_q = 0;
+        for (int t : query_tokens) {
+            qw[t] = static_cast<double>(tfOf(cnt[t], max_freq)) * (use_idf ? hasher.idfOf(t) : 1.0);
+            sum_q += qw[t];
+            cnt[t] = 0;
+        }
+    }
+
+    // Start scoring windows of doc, whose weights are built; ends any
+    // previous document.
+    void setDoc(const int *tokens, const DocWeights<WeightType> &doc_weights) {
+        endDoc();
+        doc = tokens;
+        weights = &doc_weights;
+    }
+
+    // Similarity of window [i, j] of the current document.
+    double score(int i, int j) {
+        int to = j + 1;
+        while (hi < to) add(doc[hi++]);
+        while (lo > i) add(doc[--lo]);
+        while (hi > to) remove(doc[--hi]);
+        while (lo < i) remove(doc[lo++]);
+        double denom = sum_q + sum_w - sum_min;
+        return denom > 0 ? sum_min / denom : 0.0;
+    }
+
+    // Clear the window counts.
+    void endDoc() {
+        while (lo < hi) remove(doc[lo++]);
+        lo = hi = 0;
+        sum_w = sum_min = 0;
+    }
+
+    long long memoryBytes() const {
+        return vectorBytes(qw) + vectorBytes(query_tokens) + vectorBytes(cnt);
+    }
+};